@@ -620,6 +620,57 @@ PackAnomaly *check_package(const char *buf, uint32_t len)
 	return pa;
 }
 
+uint8_t get_pattern_length()
+{
+	return pat_length;
+}
+
+uint32_t make_joint(char *joint, uint8_t tail_len, const char *buf,
+	uint32_t len)
+{
+	// Окну на стыке нужно не больше pat_length-1 байт нового сегмента
+	if (len > pat_length - 1)
+		len = pat_length - 1;
+	memcpy(joint + tail_len, buf, len);
+	return tail_len + len;
+}
+
+uint8_t update_tail(char *tail, uint8_t tail_len, const char *buf,
+	uint32_t len)
+{
+	uint8_t size = pat_length - 1;
+	if (len >= size)
+	{
+		memcpy(tail, buf + len - size, size);
+		return size;
+	}
+	// Короткий сегмент дополняет сохраненный конец
+	if (tail_len + len > size)
+	{
+		uint8_t drop = tail_len + len - size;
+		memmove(tail, tail + drop, tail_len - drop);
+		tail_len -= drop;
+	}
+	memcpy(tail + tail_len, buf, len);
+	return tail_len + len;
+}
+
+void break_joint_into_patterns(const char *joint, uint32_t len,
+	uint8_t tail_len)
+{
+	for (uint32_t i = 0; i < tail_len && i + pat_length <= len; i += pat_shift)
+		parse_pattern(joint + i);
+}
+
+PackAnomaly *check_joint(const char *joint, uint32_t len, uint8_t tail_len)
+{
+	PackAnomaly *pa = NULL;
+	for (uint32_t i = 0; i < tail_len && i + pat_length <= len && pa == NULL;
+		i += pat_shift)
+		pa = check_pattern(joint + i);
+	return pa;
+}
+
 StatAnomaly *check_statistics(const VectorType *vector)
 {
 	StatAnomaly *sa = NULL;
@@ -219,6 +219,52 @@ void unpack_detectors(const char *data, TimeData *stud_time);
 */
 PackAnomaly *check_package(const char *buf, uint32_t len);
 
+/**
+@brief Получает длину шаблона пакета
+@return Длина шаблона
+*/
+uint8_t get_pattern_length();
+
+/**
+@brief Дописывает начало нового сегмента после конца предыдущего
+@param joint Буфер склейки, начинающийся с конца предыдущего сегмента
+@param tail_len Длина конца предыдущего сегмента
+@param buf Данные нового сегмента
+@param len Длина данных
+@return Длина склейки
+*/
+uint32_t make_joint(char *joint, uint8_t tail_len, const char *buf,
+	uint32_t len);
+
+/**
+@brief Сохраняет последние pat_length-1 байт потока после нового сегмента
+@param tail Конец потока (не менее pat_length-1 байт)
+@param tail_len Текущая длина конца потока
+@param buf Данные нового сегмента
+@param len Длина данных
+@return Новая длина конца потока
+*/
+uint8_t update_tail(char *tail, uint8_t tail_len, const char *buf,
+	uint32_t len);
+
+/**
+@brief Разделяет на шаблоны только окна, пересекающие стык сегментов
+@param joint Склейка конца предыдущего и начала нового сегмента
+@param len Длина склейки
+@param tail_len Длина конца предыдущего сегмента
+*/
+void break_joint_into_patterns(const char *joint, uint32_t len,
+	uint8_t tail_len);
+
+/**
+@brief Проверяет только окна, пересекающие стык сегментов
+@param joint Склейка конца предыдущего и начала нового сегмента
+@param len Длина склейки
+@param tail_len Длина конца предыдущего сегмента
+@return Сведение об аномалии
+*/
+PackAnomaly *check_joint(const char *joint, uint32_t len, uint8_t tail_len);
+
 /**
 @brief Проверяет текущую статистику на аномальность
 @param vector Проверяемый вектор статистики
@@ -9,25 +9,88 @@
 #include "analyzer.h"
 
 NBStats *stats  = NULL;     // Для сбора статистики  поведения сети
-PList *tcp_ports = NULL;    // Список разрешенных TCP портов
-PList *udp_ports = NULL;    // Список разрешенных UDP портов
+uint8_t *tcp_profiles = NULL; // Профили TCP портов (по номеру в сетевом порядке)
+uint8_t *udp_profiles = NULL; // Профили UDP портов (по номеру в сетевом порядке)
 PList *min_det_save = NULL; // Минуты между сохранением детекторов
 AnalyzerList *alist = NULL; // Ссылка на циклический список анализаторов
-SynTCPList *beg_synlist = NULL; // Список полуоткрытых соединений 
-SynTCPList *end_synlist = NULL;
-Bool is_stats_changed = FALSE;  // Были ли изменения в статистике
-uint16_t alist_count; // Количество анализаторов в списке
+uint16_t alist_count; // Количество работающих анализаторов
+uint16_t alist_nodes; // Количество анализаторов в списке (с выведенными)
+AnalyzerData **flow_analyzers = NULL; // Анализаторы по порядку создания
+AdapterData *adapters = NULL; // Адаптеры для учета отброшенных пакетов
+uint32_t class_checked[PCLASS_COUNT];  // Проверено пакетов классов за период
+uint32_t class_wait[PCLASS_COUNT];     // Суммарное ожидание классов за период
+uint32_t class_max_wait[PCLASS_COUNT]; // Наибольшее ожидание классов за период
 HANDLE list_mutex;    // Мьютекс для работы со списком
-HANDLE lock_mutex;    // Мьютекс для контроля блокировок
-HANDLE stat_mutex;    // Мьютекс для работы со статистикой
+HANDLE space_event;   // Событие об освобождении места анализатором
+volatile LONG space_waiters = 0; // Производители, ждущие места
+StageThread *stage_threads[STAGE_COUNT]; // Потоки этапов проверки
+StageQueue desc_pool; // Свободные описания пакетов
+CRITICAL_SECTION stream_locks[STREAM_LOCK_COUNT]; // Блокировки частей концов
+char *stream_tails = NULL; // Концы TCP-потоков
+size_t stream_tail_size;   // Размер одной записи конца потока
 TimeData stud_time;   // Для хранения времени обучения
 
 // Параметры из файла конфигурации
 uint8_t  work_mode;   // Режим работы анализаторов 
+uint16_t min_alist_count;    // Минимальное количество анализаторов
 uint16_t max_alist_count;    // Максимальное количество анализаторов
 uint16_t stat_col_period;    // Период сбора статистики в секундах
 uint16_t det_gen_period;     // Период генерации детектора в секундах
-size_t analyzer_buffer_size; // Максимальный размер буфера анализатора
+uint32_t queue_size = 4096;  // Записей в очереди анализатора
+uint32_t queue_mask;         // Маска номера записи в очереди
+uint32_t stream_tail_count;  // Количество отслеживаемых концов потоков
+uint32_t conn_table_size = 65536;   // Записей таблицы соединений
+uint32_t conn_tick = 100;           // Такт колеса таймеров соединений (мс)
+uint32_t syn_timeout = 30000;       // Время жизни открываемого соединения (мс)
+uint32_t conn_idle_timeout = 300000; // Время жизни соединения без пакетов (мс)
+uint32_t conn_close_timeout = 10000; // Время хранения закрытого соединения (мс)
+uint32_t spin_count = 2000;  // Проверок очереди перед ожиданием события
+uint8_t dispatch_mode = DMODE_FREE;      // Распределение пакетов
+uint8_t flow_fallback = FFALLBACK_FREE;  // Если анализатор соединения занят
+uint32_t steal_batch = 32;   // Пакетов, забираемых у другого анализатора
+uint32_t drain_batch = 32;   // Пакетов, забираемых из своей очереди за раз
+uint32_t check_batch_size;   // Наибольшее количество пакетов в пачке
+uint8_t overflow_policy = OPOLICY_DROP_NEWEST; // Если места нет ни у кого
+uint32_t block_timeout = 16; // Наибольшее ожидание места (мс)
+uint32_t priority_reserve = 10; // Доля очереди только для приоритетных (%)
+uint32_t priority_headroom;     // Записи только для приоритетных пакетов
+uint32_t fair_backlog = 256;    // Очередь на анализатор для деления по весам
+uint32_t scale_period = 1000;     // Период изменения числа анализаторов (мс)
+uint32_t scale_up_backlog = 256;  // Очередь на анализатор для добавления
+uint32_t scale_up_wait = 50;      // Ожидание в очереди для добавления (мс)
+uint32_t scale_down_backlog = 8;  // Очередь на анализатор для вывода
+uint32_t scale_down_periods = 30; // Сколько периодов подряд нагрузка низкая
+// Потоки этапов (0 - этап выполняет поток предыдущего этапа)
+uint32_t stage_thread_count[STAGE_COUNT] = { 0, 0, 1 };
+uint32_t stage_queue_size = 4096; // Описаний в очереди потока этапа
+uint32_t slot_size = 2048;        // Размер слота пакета обычного размера
+uint32_t jumbo_slot_count = 64;   // Слотов пакетов максимального размера
+
+/**
+@brief Создает таблицу профилей всех портов протокола
+@param ps - Список разрешенных портов
+@return Таблица на 65536 портов
+*/
+uint8_t *create_port_profiles(PList *ps);
+
+/**
+@brief Считывает значения параметра с профилями портов вида
+порт:проверка:вывод
+@param profiles - Таблица профилей портов протокола
+*/
+void read_port_profiles(uint8_t *profiles);
+
+/**
+@brief Получает профиль пакета по профилям его портов
+@note Разрешенность определяется портом получателя, проверка и вывод
+ограничиваются профилями обоих портов
+@param profiles - Таблица профилей портов протокола
+@param src_port - Порт отправителя
+@param dst_port - Порт получателя
+@return Профиль обслуживания пакета
+*/
+uint8_t get_port_profile(const uint8_t *profiles, uint16_t src_port,
+	uint16_t dst_port);
 
 /**
 @brief Создает анализатор в новом потоке
@@ -37,47 +100,389 @@ size_t analyzer_buffer_size; // Максимальный размер буфер
 AnalyzerList *create_analyzer(Bool unlock);
 
 /**
-@brief Получает свободный анализатор
-@param length - Размер пространства, которое нужно занять
+@brief Выводит из работы последний анализатор таблицы, который удалось занять
+@note Анализатор остается занятым, поэтому производители его пропускают,
+а его поток завершается, проверив очередь
+@return TRUE - анализатор выводится из работы
 */
-AnalyzerData *get_free_analyzer(size_t length);
+Bool retire_analyzer();
 
 /**
-@brief Анализирует пакет протокола TCP
-@param pd - Данные пакета
+@brief Получает свободный анализатор, применяя при нехватке места
+политику переполнения
+@param data - Данные об адаптере
+@param count - Количество пакетов, под которые нужно занять место
+@param pclass - Класс обслуживания пакетов
+@return Занятый анализатор (NULL - пакеты надо отбросить)
 */
-void analyze_tcp(PackageData *pd);
- 
+AnalyzerData *get_free_analyzer(AdapterData *data, uint32_t count,
+	uint8_t pclass);
+
 /**
-@brief Анализирует пакет протокола UDP
-@param pd - Данные пакета
+@brief Занимает анализатор с самой короткой очередью, если у него есть место
+@param count - Количество пакетов, под которые нужно занять место
+@return Занятый анализатор (NULL - анализатор занят или места нет)
 */
-void analyze_udp(PackageData *pd);
+AnalyzerData *find_shortest_analyzer(uint32_t count);
 
 /**
-@brief Анализирует пакет протокола ICMP
-@param pd - Данные пакета
+@brief Получает количество записей, которое нужно найти для пакетов класса
+@note Обычные пакеты не занимают резерв очереди для приоритетных
+@param count - Количество пакетов, под которые нужно занять место
+@param pclass - Класс обслуживания пакетов
+@return Количество записей с учетом резерва
+*/
+uint32_t get_class_length(uint32_t count, uint8_t pclass);
+
+/**
+@brief Определяет класс обслуживания пакета
+@param buffer - Содержимое пакета
+@param count - Количество принятых байт
+@return Класс обслуживания
+*/
+uint8_t get_package_class(const char *buffer, size_t count);
+
+/**
+@brief Проверяет, занял ли адаптер при перегрузке больше места в очередях,
+чем ему положено по весу среди адаптеров, пакеты которых есть в очередях
+@param data - Данные об адаптере
+@return TRUE - обычные пакеты адаптера не принимаются
+*/
+Bool is_share_exceeded(AdapterData *data);
+
+/**
+@brief Ищет анализатор со свободным местом, сначала среди работающих
+рядом с приёмом адаптера, затем среди остальных
+@param count - Количество пакетов, под которые нужно занять место
+@param group - Группа анализаторов адаптера
+@return Занятый анализатор (NULL - места нет)
+*/
+AnalyzerData *find_free_analyzer(uint32_t count, uint32_t group);
+
+/**
+@brief Освобождает место, отбрасывая самые старые пакеты очереди
+@param data - Занятый анализатор (NULL - анализатор с самой длинной очередью)
+@param count - Количество пакетов, под которые нужно занять место
+@return Занятый анализатор (NULL - место не освободилось, анализатор
+освобожден)
+*/
+AnalyzerData *drop_oldest(AnalyzerData *data, uint32_t count);
+
+/**
+@brief Ждет, пока какой-либо анализатор освободит место
+@param start - Время начала ожидания (0 - еще не начато)
+@return FALSE - время ожидания block_timeout истекло
+*/
+Bool wait_for_space(DWORD *start);
+
+/**
+@brief Учитывает пакеты, отброшенные из-за нехватки места
+@param data - Данные об адаптере
+@param count - Количество пакетов
+*/
+void count_dropped(AdapterData *data, uint32_t count);
+
+/**
+@brief Получает анализатор для пакета согласно режиму распределения
+@param data - Данные об адаптере
+@param buffer - Содержимое пакета
+@param count - Количество принятых байт
+@param pclass - Класс обслуживания пакета
+@return Занятый анализатор (NULL - пакет надо отбросить)
+*/
+AnalyzerData *get_analyzer(AdapterData *data, const char *buffer,
+	size_t count, uint8_t pclass);
+
+/**
+@brief Получает анализатор, закрепленный за соединением пакета
+@param data - Данные об адаптере
+@param buffer - Содержимое пакета
+@param count - Количество принятых байт
+@param pclass - Класс обслуживания пакета
+@return Занятый анализатор (NULL - пакет надо отбросить)
+*/
+AnalyzerData *get_flow_analyzer(AdapterData *data, const char *buffer,
+	size_t count, uint8_t pclass);
+
+/**
+@brief Вычисляет хеш соединения, одинаковый для обоих направлений
+@param buffer - Содержимое пакета
+@param count - Количество принятых байт
+@return Хеш адресов, портов и протокола
+*/
+uint32_t get_flow_hash(const char *buffer, size_t count);
+
+/**
+@brief Передает на анализ один пакет, оставленный в кадре UMEM
+@param data - Данные об адаптере
+@param frame - Кадр с пакетом
+@param count - Количество принятых байт
+*/
+void analyze_frame(AdapterData *data, UmemFrame *frame, uint32_t count);
+
+/**
+@brief Записывает в очередь пакет, оставленный в кадре UMEM
+@param adata - Данные анализатора с занятым местом под пакет
+@param data - Данные об адаптере
+@param frame - Кадр с пакетом
+@param count - Количество принятых байт
+@param pclass - Класс обслуживания пакета
+*/
+void write_frame(AnalyzerData *adata, AdapterData *data, UmemFrame *frame,
+	uint32_t count, uint8_t pclass);
+
+/**
+@brief Записывает в очередь пакет, находящийся в слоте пула или в кадре UMEM
+@param adata - Данные анализатора с занятым местом под пакет
+@param data - Данные об адаптере
+@param package - Пакет
+@param frame - Кадр с пакетом (NULL - пакет в слоте)
+@param pclass - Класс обслуживания пакета
+*/
+void write_entry(AnalyzerData *adata, AdapterData *data, IPHeader *package,
+	UmemFrame *frame, uint8_t pclass);
+
+/**
+@brief Проверяет, есть ли свободные записи в очереди занятого анализатора
+@param data - Данные анализатора
+@param count - Количество пакетов, под которые нужно занять место
+@return TRUE - записи есть, первая из них имеет номер written
+*/
+Bool reserve_space(AnalyzerData *data, uint32_t count);
+
+/**
+@brief Делает записанные пакеты видимыми анализатору и будит его поток
+@param adata - Данные анализатора
+*/
+void publish_packages(AnalyzerData *adata);
+
+/**
+@brief Будит поток анализатора, ожидающий новых пакетов
+@param adata - Данные анализатора
+*/
+void wake_analyzer(AnalyzerData *adata);
+
+/**
+@brief Получает количество пакетов, ожидающих проверки
+@param data - Данные анализатора
+@return Длина очереди
+*/
+uint32_t get_backlog(AnalyzerData *data);
+
+/**
+@brief Забирает пакеты из начала очереди анализатора
+@param data - Данные анализатора
+@param max - Сколько пакетов забрать не более
+@param first - Для записи номера первого забранного пакета
+@return Количество забранных пакетов (0 - очередь пуста или занята)
+*/
+uint32_t claim_packages(AnalyzerData *data, uint32_t max, uint32_t *first);
+
+/**
+@brief Передает забранные пакеты на проверку или отбрасывает их
+@note Запись проверяемого пакета освобождает этап, прочитавший его последним
+@param data - Данные анализатора, из очереди которого забраны пакеты
+@param first - Номер первого забранного пакета
+@param count - Количество забранных пакетов
+@param batch - Рабочая область потока (NULL - отбросить пакеты)
+@return Количество пакетов
+*/
+uint32_t process_packages(AnalyzerData *data, uint32_t first, uint32_t count,
+	AnalyzerBatch *batch);
+
+/**
+@brief Разбирает заголовки пачки пакетов и передает их этапам проверки
+@param data - Данные анализатора, из очереди которого забраны пакеты
+@param first - Номер первого пакета пачки
+@param count - Количество пакетов
+@param batch - Рабочая область потока
+@return Количество переданных пакетов
+*/
+uint32_t decode_packages(AnalyzerData *data, uint32_t first, uint32_t count,
+	AnalyzerBatch *batch);
+
+/**
+@brief Берет свободное описание пакета, ожидая его, если все заняты
+@return Описание пакета
+*/
+PackageDesc *take_desc();
+
+/**
+@brief Передает пакеты этапу: в очереди его потоков по соединениям или,
+если потоков у этапа нет, проверяет их сразу
+@param stage - Этап
+@param descs - Описания пакетов
+@param count - Количество пакетов
+@param batch - Рабочая область потока
+*/
+void pass_stage(uint8_t stage, PackageDesc **descs, uint32_t count,
+	AnalyzerBatch *batch);
+
+/**
+@brief Выполняет этап проверки над пачкой пакетов
+@param stage - Этап
+@param descs - Описания пакетов
+@param count - Количество пакетов
+@param batch - Рабочая область потока
+*/
+void run_stage(uint8_t stage, PackageDesc **descs, uint32_t count,
+	AnalyzerBatch *batch);
+
+/**
+@brief Снимает ссылку этапа с пакетов и освобождает записи пакетов, которые
+больше не читает ни один этап
+@param descs - Описания пакетов
+@param count - Количество пакетов
+*/
+void release_descs(PackageDesc **descs, uint32_t count);
+
+/**
+@brief Выделяет рабочую область потока
+@param batch - Рабочая область
+@param counters - Счетчики статистики потока
+@param classes - Счетчики ожидания классов потока
+*/
+void alloc_batch(AnalyzerBatch *batch, NBCounters *counters,
+	ClassCounters *classes);
+
+/**
+@brief Освобождает рабочую область потока
+@param batch - Рабочая область
+*/
+void free_batch(AnalyzerBatch *batch);
+
+/**
+@brief Учитывает ожидание пакета в очереди
+@param classes - Счетчики классов потока
+@param pclass - Класс обслуживания пакета
+@param wait - Время ожидания в мс
 */
-void analyze_icmp(PackageData *pd);
+void count_wait(ClassCounters *classes, uint8_t pclass, uint32_t wait);
 
 /**
-@brief Анализирует пакет без связи с протоколом
+@brief Забирает часть очереди самого загруженного анализатора
+@param thief - Данные простаивающего анализатора
+@param batch - Рабочая область потока
+@return Количество проверенных пакетов
+*/
+uint32_t steal_packages(AnalyzerData *thief, AnalyzerBatch *batch);
+
+/**
+@brief Прибавляет к статистике приращения счетчиков всех анализаторов и
+потоков этапа статистики с прошлого сбора, ограничивая значения 65535
+@return TRUE - статистика изменилась
+*/
+Bool merge_stats();
+
+/**
+@brief Прибавляет к статистике приращения счетчиков потока с прошлого сбора
+@param counters - Счетчики потока
+@param merged - Счетчики на момент прошлого сбора
+@return TRUE - статистика изменилась
+*/
+Bool merge_counters(NBCounters *counters, NBCounters *merged);
+
+/**
+@brief Прибавляет к итогам периода приращения счетчиков классов анализатора
+@param data - Данные анализатора
+*/
+void merge_classes(AnalyzerData *data);
+
+/**
+@brief Записывает в лог очередь каждого анализатора, количество пакетов,
+взятых у других анализаторов, отброшенные пакеты анализаторов и
+адаптеров, глубину очередей и среднее и наибольшее ожидание каждого
+класса, а также отслеживаемые и устаревшие соединения с прошлой записи
+*/
+void log_analyzers();
+
+/**
+@brief Получает длину пакета, ограниченную количеством принятых байт
+@param buffer - Содержимое пакета
+@param count - Количество принятых байт
+@return Длина пакета
+*/
+uint16_t get_package_length(const char *buffer, size_t count);
+
+/**
+@brief Копирует пакет в слот пула и записывает его в очередь анализатора
+@param adata - Данные анализатора с занятым местом под пакет
+@param data - Данные об адаптере
+@param buffer - Содержимое пакета
+@param len - Длина пакета
+@param pclass - Класс обслуживания пакета
+@return FALSE - свободных слотов нет, пакет надо отбросить
+*/
+Bool write_package(AnalyzerData *adata, AdapterData *data,
+	const char *buffer, uint16_t len, uint8_t pclass);
+
+/**
+@brief Возвращает в пул слот или кадр UMEM проверенного пакета
 @param pd - Данные пакета
 */
-void analyze_ip(PackageData *pd);
+void free_package(PackageData *pd);
 
 /**
-@brief Проверяет содержимое пакета
-@param info Информация о пакете
+@brief Получает конец потока, предшествующий сегменту, и сохраняет новый
+@param package - IP-заголовок сегмента
+@param tcp - TCP-заголовок сегмента
+@param flow - Соединение и направление сегмента
+@param buf - Данные сегмента
+@param len - Длина данных
+@param joint - Для записи конца предыдущего сегмента
+@return Длина конца (0 - сегмент не продолжает известный поток)
 */
-void analyze_data(PackageInfo *info);
+uint8_t swap_stream_tail(IPHeader *package, TCPHeader *tcp, uint32_t flow,
+	const char *buf, uint32_t len, char *joint);
+
+/**
+@brief Проверяет данные TCP-сегмента вместе со стыком с предыдущим
+@param info - Информация о пакете
+@param package - IP-заголовок сегмента
+@param tcp - TCP-заголовок сегмента
+@param flow - Соединение и направление сегмента
+*/
+void analyze_stream(PackageInfo *info, IPHeader *package, TCPHeader *tcp,
+	uint32_t flow);
 
 /**
-@brief Разбор нужных элементов IP заголовка
+@brief Разбирает заголовки пакета
 @param pd - Данные пакета
-@return Структура с основным содержимым для вывода
+@param pe - Для записи заголовков
+@param info - Для записи основного содержимого для вывода
+@param time_buff - Время начала проверки пачки
+*/
+void decode_package(PackageData *pd, PackageEntry *pe, PackageInfo *info,
+	const char *time_buff);
+
+/**
+@brief Собирает статистику по пачке пакетов в счетчики потока и отмечает
+соединения пакетов
+@param counters - Счетчики статистики потока
+@param descs - Описания разобранных пакетов
+@param count - Количество пакетов
+*/
+void update_stats(NBCounters *counters, PackageDesc **descs, uint32_t count);
+
+/**
+@brief Проверяет содержимое разобранного пакета
+@param pe - Заголовки пакета
+@param info - Информация о пакете
+*/
+void check_entry(PackageEntry *pe, PackageInfo *info);
+
+/**
+@brief Формирует заголовок записи о пакете по шаблону протокола
+@param pe - Заголовки пакета
+@param log - Запись о пакете
+*/
+void format_entry(const PackageEntry *pe, PackageLog *log);
+
+/**
+@brief Проверяет содержимое пакета
+@param info Информация о пакете
 */
-PackageInfo get_ip_info(PackageData *pd);
+void analyze_data(PackageInfo *info);
 
 /**
 @brief Блокировка анализатора
@@ -92,19 +497,6 @@ Bool lock_analyzer(AnalyzerData *data);
 */
 void unlock_analyzer(AnalyzerData *data);
 
-/**
-@brief Добавляет адрес в список полуоткрытых соединения
-@param src - Адрес отправителя
-*/
-void add_syn_tcp_list(uint32_t src);
-
-/**
-@brief Удаляет адрес из списка полуоткрытых соединения
-@param src - Адрес отправителя
-@return TRUE - был ли такой элемент в списке
-*/
-Bool remove_syn_tcp_list(uint32_t src);
-
 /**
 @brief Поток для проверки пакетов
 */
@@ -125,15 +517,24 @@ DWORD WINAPI gd_thread(LPVOID ptr);
 */
 DWORD WINAPI stats_thread(LPVOID ptr);
 
+/**
+@brief Поток для изменения количества анализаторов по нагрузке
+*/
+DWORD WINAPI sc_thread(LPVOID ptr);
+
+/**
+@brief Поток этапа проверки
+*/
+DWORD WINAPI stage_thread(LPVOID ptr);
+
 void run_analyzer(PList *tcp_ps, PList *udp_ps)
 {
-	tcp_ports = tcp_ps;
-	udp_ports = udp_ps;
+	tcp_profiles = create_port_profiles(tcp_ps);
+	udp_profiles = create_port_profiles(udp_ps);
 	min_det_save = create_plist(); 
 	
-	uint16_t min_alist_count;
 	list_mutex = CreateMutex(NULL, FALSE, NULL);
-	lock_mutex = CreateMutex(NULL, FALSE, NULL);
+	space_event = CreateEvent(NULL, FALSE, FALSE, NULL);
 
 	// Получение параметров
 	while (is_reading_settings_section("Analyzer"))
@@ -146,8 +547,7 @@ void run_analyzer(PList *tcp_ps, PList *udp_ps)
 		else if (strcmp(name, "max_analyzer_count") == 0)
 			max_alist_count = read_setting_u();
 		else if (strcmp(name, "max_packet_in_analyzer") == 0)
-			analyzer_buffer_size = read_setting_u() *
-				(PACKAGE_DATA_SIZE + PACKAGE_BUFFER_SIZE);
+			queue_size = read_setting_u();
 		else if (strcmp(name, "detector_save_periods") == 0)
 			while (is_reading_setting_value())
 				add_in_plist(min_det_save, read_setting_u());
@@ -155,15 +555,156 @@ void run_analyzer(PList *tcp_ps, PList *udp_ps)
 			stat_col_period = read_setting_u();
 		else if (strcmp(name, "detector_generation_period") == 0)		
 			det_gen_period = read_setting_u();
+		else if (strcmp(name, "stream_tail_count") == 0)
+			stream_tail_count = read_setting_u();
+		else if (strcmp(name, "tcp_port_profiles") == 0)
+			read_port_profiles(tcp_profiles);
+		else if (strcmp(name, "udp_port_profiles") == 0)
+			read_port_profiles(udp_profiles);
+		else if (strcmp(name, "conn_table_size") == 0)
+			conn_table_size = read_setting_u();
+		else if (strcmp(name, "conn_tick") == 0)
+			conn_tick = read_setting_u();
+		else if (strcmp(name, "syn_timeout") == 0)
+			syn_timeout = read_setting_u();
+		else if (strcmp(name, "conn_idle_timeout") == 0)
+			conn_idle_timeout = read_setting_u();
+		else if (strcmp(name, "conn_close_timeout") == 0)
+			conn_close_timeout = read_setting_u();
+		else if (strcmp(name, "spin_count") == 0)
+			spin_count = read_setting_u();
+		else if (strcmp(name, "dispatch_mode") == 0)
+			dispatch_mode = strcmp(read_setting_s(), "flow") == 0 ?
+				DMODE_FLOW : DMODE_FREE;
+		else if (strcmp(name, "flow_fallback") == 0)
+			flow_fallback = strcmp(read_setting_s(), "wait") == 0 ?
+				FFALLBACK_WAIT : FFALLBACK_FREE;
+		else if (strcmp(name, "steal_batch") == 0)
+			steal_batch = read_setting_u();
+		else if (strcmp(name, "drain_batch") == 0)
+			drain_batch = read_setting_u();
+		else if (strcmp(name, "overflow_policy") == 0)
+		{
+			const char *policy = read_setting_s();
+			if (strcmp(policy, "drop_oldest") == 0)
+				overflow_policy = OPOLICY_DROP_OLDEST;
+			else if (strcmp(policy, "block") == 0)
+				overflow_policy = OPOLICY_BLOCK;
+			else
+				overflow_policy = OPOLICY_DROP_NEWEST;
+		}
+		else if (strcmp(name, "block_timeout") == 0)
+			block_timeout = read_setting_u();
+		else if (strcmp(name, "priority_reserve") == 0)
+			priority_reserve = read_setting_u();
+		else if (strcmp(name, "fair_backlog") == 0)
+			fair_backlog = read_setting_u();
+		else if (strcmp(name, "scale_period") == 0)
+			scale_period = read_setting_u();
+		else if (strcmp(name, "scale_up_backlog") == 0)
+			scale_up_backlog = read_setting_u();
+		else if (strcmp(name, "scale_up_wait") == 0)
+			scale_up_wait = read_setting_u();
+		else if (strcmp(name, "scale_down_backlog") == 0)
+			scale_down_backlog = read_setting_u();
+		else if (strcmp(name, "scale_down_periods") == 0)
+			scale_down_periods = read_setting_u();
+		else if (strcmp(name, "stats_threads") == 0)
+			stage_thread_count[STAGE_STATS] = read_setting_u();
+		else if (strcmp(name, "scan_threads") == 0)
+			stage_thread_count[STAGE_SCAN] = read_setting_u();
+		else if (strcmp(name, "log_threads") == 0)
+			stage_thread_count[STAGE_LOG] = read_setting_u();
+		else if (strcmp(name, "stage_queue_size") == 0)
+			stage_queue_size = read_setting_u();
+		else if (strcmp(name, "slot_size") == 0)
+			slot_size = read_setting_u();
+		else if (strcmp(name, "jumbo_slot_count") == 0)
+			jumbo_slot_count = read_setting_u();
 		else
 			print_not_used(name);
 	}
 
+	// Пакеты соединения должны проверяться по порядку одним анализатором
+	if (dispatch_mode == DMODE_FLOW)
+		steal_batch = 0;
+	if (drain_batch == 0)
+		drain_batch = 1;
+	check_batch_size = drain_batch > steal_batch ? drain_batch : steal_batch;
+	// Номер записи в кольце очереди получается маской; размер больше
+	// наибольшей степени двойки не округлить
+	if (queue_size > MAX_QUEUE_SIZE)
+		queue_size = MAX_QUEUE_SIZE;
+	uint32_t entries = 2;
+	while (entries < queue_size)
+		entries <<= 1;
+	queue_size = entries;
+	queue_mask = entries - 1;
+	if (priority_reserve > 100)
+		priority_reserve = 100;
+	priority_headroom = queue_size / 100 * priority_reserve;
+	// Слотов хватает на полные очереди всех анализаторов и на кэши потоков;
+	// сначала память выделяется под наименьшее количество анализаторов
+	init_slot_pools(slot_size, (min_alist_count + 1) * queue_size,
+		(max_alist_count + 1) * queue_size, jumbo_slot_count);
+
 	// Инициализация параметров алгоритм отрицательного отбора
 	init_algorithm(&stud_time, work_mode == WMODE_STUD);
 	stats = get_statistics();
+	
+	init_conntrack(conn_table_size, conn_tick, syn_timeout, conn_idle_timeout,
+		conn_close_timeout);
+
+	// Концы потоков хранят по pat_length-1 байт на направление
+	if (stream_tail_count > 0 && get_pattern_length() > 1)
+	{
+		for (int i = 0; i < STREAM_LOCK_COUNT; i++)
+			InitializeCriticalSection(&stream_locks[i]);
+		stream_tail_size = (sizeof(StreamTail) + get_pattern_length() - 1 +
+			sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+		stream_tails = (char *)calloc(stream_tail_count, stream_tail_size);
+	}
+
+	// Описаний хватает на очереди этапов и на пачки всех потоков
+	uint32_t desc_count = max_alist_count * check_batch_size;
+	for (int i = 0; i < STAGE_COUNT; i++)
+		desc_count += stage_thread_count[i] *
+			(stage_queue_size + check_batch_size);
+	init_stage_queue(&desc_pool, desc_count);
+	PackageDesc *descs = (PackageDesc *)malloc(desc_count *
+		sizeof(PackageDesc));
+	for (uint32_t i = 0; i < desc_count; i++)
+		push_stage(&desc_pool, &descs[i]);
 
 	HANDLE hThread = NULL;
+
+	// Создание потоков этапов проверки
+	const char *stage_names[STAGE_COUNT] =
+		{ "Statistics stage", "Scan stage", "Log stage" };
+	for (int i = 0; i < STAGE_COUNT; i++)
+	{
+		stage_threads[i] = (StageThread *)calloc(stage_thread_count[i],
+			sizeof(StageThread));
+		for (uint32_t j = 0; j < stage_thread_count[i]; j++)
+		{
+			StageThread *st = &stage_threads[i][j];
+			st->stage = i;
+			init_stage_queue(&st->queue, stage_queue_size);
+			hThread = CreateThread(NULL, 0, stage_thread, st, 0, NULL);
+			if (hThread == NULL)
+			{
+				print_msglog("Thread of packet check stage not created!");
+				exit(9);
+			}
+			// Вывод в файлы - вспомогательная работа
+			char name[32];
+			snprintf(name, sizeof(name), "%s #%u", stage_names[i], j + 1);
+			if (i == STAGE_LOG)
+				place_thread(hThread, TCLASS_HELPER, 5 + j, name);
+			else
+				place_thread(hThread, TCLASS_ANALYZER, j, name);
+		}
+	}
 	
 	if (work_mode == WMODE_STUD)
 	{
@@ -174,6 +715,7 @@ void run_analyzer(PList *tcp_ps, PList *udp_ps)
 			print_msglog("Thread to save detectors not created!");
 			exit(6);
 		}
+		place_thread(hThread, TCLASS_HELPER, 1, "Detector saving");
 		
 		// Создание потока для генерации детекторов
 		hThread = CreateThread(NULL, 0, gd_thread, NULL, 0, NULL);
@@ -182,71 +724,837 @@ void run_analyzer(PList *tcp_ps, PList *udp_ps)
 			print_msglog("Thread to save statistics not created!");
 			exit(7);
 		}	
+		place_thread(hThread, TCLASS_HELPER, 2, "Detector generation");
 	}
 
 	// Создание потока для сохранения статистики
 	hThread = CreateThread(NULL, 0, stats_thread, NULL, 0, NULL);
 	if (hThread == NULL)
 	{
-		print_msglog("Thread to save statistics not created!");
-		exit(8);
+		print_msglog("Thread to save statistics not created!");
+		exit(8);
+	}
+	place_thread(hThread, TCLASS_HELPER, 3, "Statistics");
+	
+	// Создание требуемого количества анализаторов
+	flow_analyzers = (AnalyzerData **)calloc(max_alist_count,
+		sizeof(AnalyzerData *));
+	for (int i = 0; i  < min_alist_count; i++)
+		create_analyzer(FALSE);
+
+	// Создание потока для изменения количества анализаторов
+	if (scale_period > 0 && min_alist_count < max_alist_count)
+	{
+		hThread = CreateThread(NULL, 0, sc_thread, NULL, 0, NULL);
+		if (hThread == NULL)
+			print_errlog("Failed to create thread!\n");
+		place_thread(hThread, TCLASS_HELPER, 4, "Scaling");
+	}
+}
+
+void register_adapter(AdapterData *data)
+{
+	data->dropped = 0;
+	data->lost = 0;
+	data->weight = 1;
+	data->queued[PCLASS_PRIORITY] = 0;
+	data->queued[PCLASS_BULK] = 0;
+	data->group = THREAD_GROUP_ANY;
+	// Адаптеры добавляются потоками настройки и воспроизведения
+	do
+		data->next = adapters;
+	while (InterlockedCompareExchangePointer((PVOID volatile *)&adapters, data,
+		data->next) != data->next);
+}
+
+Bool is_package_accepted(const char *buffer, size_t count)
+{
+	return count >= sizeof(IPHeader) && is_package_passed(buffer, count) &&
+		!is_package_duplicate(buffer, count);
+}
+
+Bool assemble_package(AdapterData *data, const char *buffer, size_t count)
+{
+	ReasmBuffer *rb;
+	uint8_t res = reassemble_package(buffer, count, &rb);
+	if (res == REASM_DONE)
+	{
+		analyze_package(data, rb->package, rb->size);
+		release_reasm_buffer(rb);
+	}
+	return res == REASM_PASS;
+}
+
+size_t assemble_slot(PackageSlot *slot, size_t count)
+{
+	ReasmBuffer *rb;
+	uint8_t res = reassemble_package(get_slot_buffer(slot), count, &rb);
+	if (res == REASM_HOLD)
+		return 0;
+	if (res == REASM_DONE)
+	{
+		count = rb->size;
+		// Собранная датаграмма переносится в слот большого пакета
+		if (count > get_slot_length(slot) && !grow_slot(slot))
+		{
+			release_reasm_buffer(rb);
+			return 0;
+		}
+		memcpy(get_slot_buffer(slot), rb->package, count);
+		release_reasm_buffer(rb);
+	}
+	return count;
+}
+
+void analyze_package(AdapterData *data, const char *buffer, size_t count)
+{
+	uint16_t len = get_package_length(buffer, count);
+	uint8_t pclass = get_package_class(buffer, len);
+	AnalyzerData *adata = NULL;
+	if (pclass == PCLASS_PRIORITY || !is_share_exceeded(data))
+		adata = get_analyzer(data, buffer, count, pclass);
+	if (adata == NULL)
+	{
+		count_dropped(data, 1);
+		return;
+	}
+	// Копирование пакета в слот пула
+	if (write_package(adata, data, buffer, len, pclass))
+		publish_packages(adata);
+	else
+		count_dropped(data, 1);
+	unlock_analyzer(adata);
+}
+
+void analyze_packages(AdapterData *data, const PackageBatch *batch)
+{
+	// Пакеты одной выборки относятся к разным соединениям
+	if (dispatch_mode == DMODE_FLOW)
+	{
+		for (uint32_t i = 0; i < batch->count; i++)
+			analyze_package(data, batch->buffers[i], batch->sizes[i]);
+		return;
+	}
+	uint32_t beg = 0;
+	while (beg < batch->count)
+	{
+		// Набор пакетов, который займет не больше половины очереди
+		uint32_t end = batch->count;
+		if (end - beg > queue_size / 2)
+			end = beg + queue_size / 2;
+		// Поиск анализатора выполняется один раз на весь набор
+		AnalyzerData *adata = NULL;
+		if (!is_share_exceeded(data))
+			adata = get_free_analyzer(data, end - beg, PCLASS_BULK);
+		if (adata == NULL)
+		{
+			// Места под набор нет, приоритетные пакеты передаются по одному
+			for (uint32_t i = beg; i < end; i++)
+				if (get_package_class(batch->buffers[i], batch->sizes[i]) ==
+					PCLASS_PRIORITY)
+					analyze_package(data, batch->buffers[i], batch->sizes[i]);
+				else
+					count_dropped(data, 1);
+			beg = end;
+			continue;
+		}
+		for (uint32_t i = beg; i < end; i++)
+		{
+			uint16_t len = get_package_length(batch->buffers[i],
+				batch->sizes[i]);
+			if (!write_package(adata, data, batch->buffers[i], len,
+				get_package_class(batch->buffers[i], len)))
+				count_dropped(data, 1);
+		}
+		publish_packages(adata);
+		unlock_analyzer(adata);
+		beg = end;
+	}
+}
+
+void analyze_frames(AdapterData *data, UmemFrame **frames,
+	const uint32_t *sizes, uint32_t count)
+{
+	// Каждый кадр получает анализатор его соединения
+	if (dispatch_mode == DMODE_FLOW)
+	{
+		for (uint32_t i = 0; i < count; i++)
+			analyze_frame(data, frames[i], sizes[i]);
+		return;
+	}
+	// В очередь анализатора записываются только ссылки на кадры
+	AnalyzerData *adata = NULL;
+	if (!is_share_exceeded(data))
+		adata = get_free_analyzer(data, count, PCLASS_BULK);
+	if (adata == NULL)
+	{
+		// Места под все кадры нет, приоритетные передаются по одному
+		for (uint32_t i = 0; i < count; i++)
+			if (get_package_class(frames[i]->data, sizes[i]) ==
+				PCLASS_PRIORITY)
+				analyze_frame(data, frames[i], sizes[i]);
+			else
+			{
+				count_dropped(data, 1);
+				release_umem_frame(frames[i]);
+			}
+		return;
+	}
+	for (uint32_t i = 0; i < count; i++)
+		write_frame(adata, data, frames[i], sizes[i],
+			get_package_class(frames[i]->data, sizes[i]));
+	publish_packages(adata);
+	unlock_analyzer(adata);
+}
+
+void analyze_frame(AdapterData *data, UmemFrame *frame, uint32_t count)
+{
+	uint8_t pclass = get_package_class(frame->data, count);
+	AnalyzerData *adata = NULL;
+	if (pclass == PCLASS_PRIORITY || !is_share_exceeded(data))
+		adata = get_analyzer(data, frame->data, count, pclass);
+	if (adata == NULL)
+	{
+		count_dropped(data, 1);
+		release_umem_frame(frame);
+		return;
+	}
+	write_frame(adata, data, frame, count, pclass);
+	publish_packages(adata);
+	unlock_analyzer(adata);
+}
+
+void write_frame(AnalyzerData *adata, AdapterData *data, UmemFrame *frame,
+	uint32_t count, uint8_t pclass)
+{
+	IPHeader *package = (IPHeader *)frame->data;
+	package->length = htons(get_package_length(frame->data, count));
+	write_entry(adata, data, package, frame, pclass);
+}
+
+void write_entry(AnalyzerData *adata, AdapterData *data, IPHeader *package,
+	UmemFrame *frame, uint8_t pclass)
+{
+	PackageData *pd = &adata->entries[adata->written & queue_mask];
+	pd->adapter = data;
+	pd->package = package;
+	pd->frame = frame;
+	pd->time = GetTickCount();
+	pd->pclass = pclass;
+	InterlockedIncrement(&data->queued[pclass]);
+	adata->written++;
+}
+
+void init_slot(PackageSlot *slot, AdapterData *data)
+{
+	slot->analyzer = NULL;
+	slot->adapter = data;
+	slot->pclass = PCLASS_BULK;
+	slot->space = 0;
+	slot->count = 0;
+	slot->buffer = NULL;
+	slot->spare = NULL;
+	slot->pool_slot = NULL;
+	if (dispatch_mode == DMODE_FLOW)
+		slot->buffer = (char *)malloc(PACKAGE_BUFFER_SIZE);
+	// Пакеты принимаются, даже если места или слотов нет, чтобы не
+	// копились в сокете
+	else
+		slot->spare = (char *)malloc(PACKAGE_BUFFER_SIZE);
+}
+
+void reserve_slot(PackageSlot *slot, uint32_t count)
+{
+	// Больше очереди анализатора занять нельзя
+	if (count > queue_size)
+		count = queue_size;
+	slot->space = count;
+	slot->count = 0;
+	// Пакеты из промежуточного буфера распределяются по одному
+	if (slot->buffer == NULL)
+	{
+		slot->pclass = PCLASS_BULK;
+		slot->analyzer = NULL;
+		if (!is_share_exceeded(slot->adapter))
+			slot->analyzer = get_free_analyzer(slot->adapter, count,
+				PCLASS_BULK);
+		// Если места под все пакеты нет, место занимается под один
+		// приоритетный пакет
+		if (slot->analyzer == NULL)
+		{
+			slot->space = 1;
+			slot->pclass = PCLASS_PRIORITY;
+			slot->analyzer = get_free_analyzer(slot->adapter, 1,
+				PCLASS_PRIORITY);
+		}
+	}
+}
+
+Bool is_slot_available(const PackageSlot *slot)
+{
+	return slot->space > 0;
+}
+
+char *get_slot_buffer(PackageSlot *slot)
+{
+	if (slot->buffer != NULL)
+		return slot->buffer;
+	// Слот пула не зависит от анализатора, поэтому пакет можно принять
+	// до занятия места; слот остается за местом до приёма подходящего пакета
+	if (slot->pool_slot == NULL)
+		slot->pool_slot = alloc_slot(0);
+	if (slot->pool_slot == NULL)
+		return slot->spare;
+	return slot->pool_slot;
+}
+
+uint32_t get_slot_length(PackageSlot *slot)
+{
+	const char *buffer = get_slot_buffer(slot);
+	if (buffer == slot->pool_slot)
+		return get_slot_size(buffer);
+	return PACKAGE_BUFFER_SIZE;
+}
+
+Bool grow_slot(PackageSlot *slot)
+{
+	char *jumbo = alloc_slot(PACKAGE_BUFFER_SIZE);
+	if (jumbo == NULL)
+	{
+		count_dropped(slot->adapter, 1);
+		return FALSE;
+	}
+	if (slot->pool_slot != NULL)
+		free_slot(slot->pool_slot);
+	slot->pool_slot = jumbo;
+	return TRUE;
+}
+
+void drop_slot(PackageSlot *slot)
+{
+	count_dropped(slot->adapter, 1);
+}
+
+void fill_slot(PackageSlot *slot, AdapterData *data, size_t count)
+{
+	if (slot->buffer != NULL)
+	{
+		analyze_package(data, slot->buffer, count);
+		return;
+	}
+	AnalyzerData *adata = slot->analyzer;
+	const char *buffer = get_slot_buffer(slot);
+	uint8_t pclass = get_package_class(buffer, count);
+	// Место, занятое под приоритетный пакет, обычным не отдается
+	if (adata == NULL || buffer == slot->spare || pclass > slot->pclass)
+	{
+		count_dropped(data, 1);
+		return;
+	}
+	// Пакет уже находится в слоте, в очередь записывается ссылка на него
+	IPHeader *package = (IPHeader *)slot->pool_slot;
+	package->length = htons(get_package_length(buffer, count));
+	write_entry(adata, data, package, NULL, pclass);
+	slot->pool_slot = NULL;
+	slot->space--;
+	slot->count++;
+}
+
+void publish_slot(PackageSlot *slot)
+{
+	if (slot->buffer != NULL)
+		return;
+	AnalyzerData *adata = slot->analyzer;
+	if (adata == NULL)
+		return;
+	if (slot->count > 0)
+		publish_packages(adata);
+	unlock_analyzer(adata);
+	slot->analyzer = NULL;
+	slot->count = 0;
+}
+
+void publish_packages(AnalyzerData *adata)
+{
+	// Записи заполнены до сдвига конца очереди
+	__atomic_store_n(&adata->pushed, adata->written, __ATOMIC_RELEASE);
+	// Парный барьер к установке parked в an_thread: либо анализатор увидит
+	// новый конец очереди, либо производитель увидит, что он уснул
+	MemoryBarrier();
+	wake_analyzer(adata);
+	// Длинную очередь помогает разобрать соседний анализатор
+	if (steal_batch > 0 && get_backlog(adata) > 2 * steal_batch)
+		wake_analyzer(__atomic_load_n(&adata->next, __ATOMIC_ACQUIRE));
+}
+
+void wake_analyzer(AnalyzerData *adata)
+{
+	// Системный вызов нужен, только если поток уже перестал проверять очередь
+	if (adata->parked && InterlockedExchange(&adata->parked, FALSE))
+		SetEvent(adata->event);
+}
+
+uint16_t get_package_length(const char *buffer, size_t count)
+{
+	IPHeader *package = (IPHeader *)buffer;
+	uint16_t len = (package->length << 8) + (package->length >> 8);
+	// Длина не может превышать количество принятых байт
+	if (len > count)
+		len = count;
+	return len;
+}
+
+Bool write_package(AnalyzerData *adata, AdapterData *data,
+	const char *buffer, uint16_t len, uint8_t pclass)
+{
+	IPHeader *package = (IPHeader *)alloc_slot(len);
+	if (package == NULL)
+		return FALSE;
+	memcpy(package, buffer, len);
+	package->length = htons(len);
+	write_entry(adata, data, package, NULL, pclass);
+	return TRUE;
+}
+
+void free_package(PackageData *pd)
+{
+	// Кадр UMEM возвращается в кольцо свободных
+	if (pd->frame != NULL)
+		release_umem_frame(pd->frame);
+	else
+		free_slot((char *)pd->package);
+}
+
+uint32_t get_backlog(AnalyzerData *data)
+{
+	return (uint32_t)data->pushed -
+		(uint32_t)__atomic_load_n(&data->head, __ATOMIC_ACQUIRE);
+}
+
+uint32_t claim_packages(AnalyzerData *data, uint32_t max, uint32_t *first)
+{
+	LONG head = __atomic_load_n(&data->head, __ATOMIC_ACQUIRE);
+	// Пустая очередь не читается: записи выведенного анализатора освобождены
+	uint32_t backlog = (uint32_t)__atomic_load_n(&data->pushed,
+		__ATOMIC_ACQUIRE) - (uint32_t)head;
+	if (max > backlog)
+		max = backlog;
+	// Записи до конца очереди не перезаписываются, пока их не освободят,
+	// поэтому пакеты забираются одной операцией без обхода
+	if (max == 0 || InterlockedCompareExchange(&data->head,
+		(LONG)((uint32_t)head + max), head) != head)
+		return 0;
+	*first = (uint32_t)head;
+	return max;
+}
+
+uint32_t process_packages(AnalyzerData *data, uint32_t first, uint32_t count,
+	AnalyzerBatch *batch)
+{
+	// Проверяемые пакеты освобождают этапы, прочитавшие их последними
+	if (batch != NULL && work_mode != WMODE_PASS)
+		return decode_packages(data, first, count, batch);
+	uint32_t now = GetTickCount();
+	// Счетчики очередей адаптеров уменьшаются один раз на серию пакетов
+	AdapterData *run_adapter = NULL;
+	uint8_t run_class = PCLASS_BULK;
+	LONG run = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PackageData *pd = &data->entries[(first + i) & queue_mask];
+		uint8_t pclass = pd->pclass;
+		if (pd->adapter != run_adapter || pclass != run_class)
+		{
+			if (run > 0)
+				InterlockedExchangeAdd(&run_adapter->queued[run_class], -run);
+			run_adapter = pd->adapter;
+			run_class = pclass;
+			run = 0;
+		}
+		run++;
+		if (batch == NULL)
+			count_dropped(pd->adapter, 1);
+		else
+			count_wait(batch->classes, pclass, now - pd->time);
+		free_package(pd);
+		// Отмечаем, что запись пакета может занять производитель
+		__atomic_store_n(&pd->adapter, NULL, __ATOMIC_RELEASE);
+	}
+	if (run > 0)
+		InterlockedExchangeAdd(&run_adapter->queued[run_class], -run);
+	InterlockedExchangeAdd(&data->finished, count);
+	if (batch == NULL)
+		InterlockedExchangeAdd(&data->dropped, count);
+	// Место освободится, когда производитель пройдет по проверенным пакетам
+	if (space_waiters > 0)
+		SetEvent(space_event);
+	return count;
+}
+
+void count_wait(ClassCounters *classes, uint8_t pclass, uint32_t wait)
+{
+	classes->checked[pclass]++;
+	classes->wait[pclass] += wait;
+	// Максимум сбрасывает поток статистики
+	if ((LONG)wait > classes->max_wait[pclass])
+		InterlockedExchange(&classes->max_wait[pclass], wait);
+}
+
+uint32_t decode_packages(AnalyzerData *data, uint32_t first, uint32_t count,
+	AnalyzerBatch *batch)
+{
+	PackageDesc **descs = batch->descs;
+	// Ожидание в очереди отсчитывается до начала проверки пачки
+	uint32_t now = GetTickCount();
+	// Время одно на пачку
+	char time_buff[9];
+	get_localtime(time_buff);
+	// Разбор заголовков
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PackageData *pd = &data->entries[(first + i) & queue_mask];
+		count_wait(batch->classes, pd->pclass, now - pd->time);
+		PackageDesc *desc = take_desc();
+		desc->pd = pd;
+		desc->owner = data;
+		desc->refs = 1;
+		decode_package(pd, &desc->entry, &desc->info, time_buff);
+		IPHeader *package = desc->entry.package;
+		desc->route = get_flow_hash((const char *)package,
+			ntohs(package->length));
+		descs[i] = desc;
+	}
+	pass_stage(STAGE_STATS, descs, count, batch);
+	return count;
+}
+
+PackageDesc *take_desc()
+{
+	PackageDesc *desc;
+	// Все описания заняты, пока следующие этапы не разберут свои очереди
+	while (pop_stage(&desc_pool, (void **)&desc, 1) == 0)
+		Sleep(1);
+	return desc;
+}
+
+void pass_stage(uint8_t stage, PackageDesc **descs, uint32_t count,
+	AnalyzerBatch *batch)
+{
+	uint32_t threads = stage_thread_count[stage];
+	if (count == 0)
+		return;
+	if (threads == 0)
+	{
+		run_stage(stage, descs, count, batch);
+		return;
+	}
+	// Пакеты соединения проверяет один поток этапа, сохраняя их порядок
+	for (uint32_t t = 0; t < threads; t++)
+	{
+		StageQueue *queue = &stage_threads[stage][t].queue;
+		uint32_t pushed = 0;
+		for (uint32_t i = 0; i < count; i++)
+			if (threads == 1 || descs[i]->route % threads == t)
+			{
+				push_stage(queue, descs[i]);
+				pushed++;
+			}
+		if (pushed > 0)
+			wake_stage(queue);
+	}
+}
+
+void run_stage(uint8_t stage, PackageDesc **descs, uint32_t count,
+	AnalyzerBatch *batch)
+{
+	if (stage == STAGE_STATS)
+	{
+		update_stats(batch->counters, descs, count);
+		// Проверка содержимого и вывод в файлы только читают пакет, поэтому
+		// получают его одновременно, каждый со своей ссылкой
+		uint32_t scans = 0;
+		uint32_t writes = 0;
+		uint32_t unused = 0;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			PackageDesc *desc = descs[i];
+			uint8_t profile = desc->entry.profile;
+			Bool scan = (profile & PPROF_SCAN) != 0;
+			Bool write = (profile & PPROF_LOG_MASK) != 0;
+			desc->refs = scan + write;
+			if (scan)
+				batch->scans[scans++] = desc;
+			if (write)
+				batch->writes[writes++] = desc;
+			// Пакет, который больше никому не нужен, освобождается сразу
+			if (!scan && !write)
+			{
+				desc->refs = 1;
+				descs[unused++] = desc;
+			}
+		}
+		// Запись в файлы идет параллельно с проверкой содержимого
+		pass_stage(STAGE_LOG, batch->writes, writes, batch);
+		pass_stage(STAGE_SCAN, batch->scans, scans, batch);
+		release_descs(descs, unused);
+	}
+	else if (stage == STAGE_SCAN)
+	{
+		// При сохранении детекторов содержимое не проверяется
+		if (work_mode != WMODE_PASS)
+			for (uint32_t i = 0; i < count; i++)
+				check_entry(&descs[i]->entry, &descs[i]->info);
+		release_descs(descs, count);
+	}
+	else
+	{
+		PackageLog *logs = batch->logs;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			uint8_t level = (descs[i]->entry.profile & PPROF_LOG_MASK) >>
+				PPROF_LOG_SHIFT;
+			logs[i].info = descs[i]->info;
+			format_entry(&descs[i]->entry, &logs[i]);
+			// Данные не выводятся, заголовок сохраняет полный размер пакета
+			if (level == PLOG_HEADER)
+				logs[i].info.shift = logs[i].info.size;
+		}
+		log_packages(logs, count);
+		release_descs(descs, count);
+	}
+}
+
+void release_descs(PackageDesc **descs, uint32_t count)
+{
+	// Счетчики очередей адаптеров и анализаторов изменяются один раз на
+	// серию пакетов
+	AdapterData *run_adapter = NULL;
+	uint8_t run_class = PCLASS_BULK;
+	LONG run = 0;
+	AnalyzerData *run_owner = NULL;
+	LONG done = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PackageDesc *desc = descs[i];
+		if (InterlockedDecrement(&desc->refs) > 0)
+			continue;
+		PackageData *pd = desc->pd;
+		if (pd->adapter != run_adapter || pd->pclass != run_class)
+		{
+			if (run > 0)
+				InterlockedExchangeAdd(&run_adapter->queued[run_class], -run);
+			run_adapter = pd->adapter;
+			run_class = pd->pclass;
+			run = 0;
+		}
+		run++;
+		if (desc->owner != run_owner)
+		{
+			if (done > 0)
+				InterlockedExchangeAdd(&run_owner->finished, done);
+			run_owner = desc->owner;
+			done = 0;
+		}
+		done++;
+		free_package(pd);
+		// Отмечаем, что запись пакета может занять производитель
+		__atomic_store_n(&pd->adapter, NULL, __ATOMIC_RELEASE);
+		push_stage(&desc_pool, desc);
+	}
+	if (run > 0)
+		InterlockedExchangeAdd(&run_adapter->queued[run_class], -run);
+	if (done > 0)
+		InterlockedExchangeAdd(&run_owner->finished, done);
+	// Место освободится, когда производитель пройдет по проверенным пакетам
+	if (space_waiters > 0)
+		SetEvent(space_event);
+}
+
+void alloc_batch(AnalyzerBatch *batch, NBCounters *counters,
+	ClassCounters *classes)
+{
+	size_t size = check_batch_size * sizeof(PackageDesc *);
+	batch->descs = (PackageDesc **)malloc(size);
+	batch->scans = (PackageDesc **)malloc(size);
+	batch->writes = (PackageDesc **)malloc(size);
+	batch->logs = (PackageLog *)malloc(check_batch_size * sizeof(PackageLog));
+	batch->counters = counters;
+	batch->classes = classes;
+}
+
+void free_batch(AnalyzerBatch *batch)
+{
+	free(batch->descs);
+	free(batch->scans);
+	free(batch->writes);
+	free(batch->logs);
+}
+
+uint32_t steal_packages(AnalyzerData *thief, AnalyzerBatch *batch)
+{
+	// Поиск анализатора с самой длинной очередью; элементы списка не
+	// удаляются, поэтому соседей можно обходить без блокировки
+	AnalyzerData *victim = NULL;
+	uint32_t max_backlog = steal_batch;
+	AnalyzerData *p = __atomic_load_n(&thief->next, __ATOMIC_ACQUIRE);
+	while (p != thief)
+	{
+		uint32_t backlog = get_backlog(p);
+		if (backlog > max_backlog)
+		{
+			max_backlog = backlog;
+			victim = p;
+		}
+		p = __atomic_load_n(&p->next, __ATOMIC_ACQUIRE);
+	}
+	if (victim == NULL)
+		return 0;
+	uint32_t first;
+	uint32_t count = claim_packages(victim, steal_batch, &first);
+	if (count == 0)
+		return 0;
+	count = process_packages(victim, first, count, batch);
+	InterlockedExchangeAdd(&thief->stolen, count);
+	return count;
+}
+
+Bool is_analyzers_idle()
+{
+	Bool idle = TRUE;
+	// В пассивном режиме очереди не разбираются
+	if (work_mode == WMODE_PASS || alist == NULL)
+		return idle;
+	WaitForSingleObject(list_mutex, INFINITE);
+	AnalyzerList *p = alist;
+	do
+	{
+		if (p->data.finished != p->data.pushed)
+			idle = FALSE;
+		p = p->next;
+	}
+	while (p != alist && idle);
+	ReleaseMutex(list_mutex);
+	return idle;
+}
+
+uint8_t *create_port_profiles(PList *ps)
+{
+	uint8_t *profiles = (uint8_t *)malloc(UINT16_MAX + 1);
+	memset(profiles, PPROF_DEFAULT, UINT16_MAX + 1);
+	for (PNode *p = ps->beg; p != NULL; p = p->next)
+		profiles[p->value] |= PPROF_ALLOWED;
+	return profiles;
+}
+
+void read_port_profiles(uint8_t *profiles)
+{
+	while (is_reading_setting_value())
+	{
+		const char *value = read_setting_s();
+		uint32_t port, scan, level;
+		if (sscanf(value, "%u:%u:%u", &port, &scan, &level) != 3 ||
+			port > UINT16_MAX || level > PLOG_DATA)
+		{
+			print_errlogf("Invalid port profile \"%s\"\n", value);
+			continue;
+		}
+		uint8_t *profile = &profiles[htons(port)];
+		*profile &= PPROF_ALLOWED;
+		if (scan)
+			*profile |= PPROF_SCAN;
+		*profile |= level << PPROF_LOG_SHIFT;
 	}
-	
-	// Создание требуемого количества анализаторов
-	for (int i = 0; i  < min_alist_count; i++)
-		create_analyzer(FALSE);
 }
 
-void analyze_package(AdapterData *data)
+uint8_t get_port_profile(const uint8_t *profiles, uint16_t src_port,
+	uint16_t dst_port)
 {
-	IPHeader *package = (IPHeader *)data->buffer;
-	uint16_t len = (package->length << 8) + (package->length >> 8);
-	size_t size = len + PACKAGE_DATA_SIZE;
-	AnalyzerData *adata = get_free_analyzer(size);
-	// Копирование информации в буфер анализатора
-	WaitForSingleObject(adata->mutex, INFINITE);
-	adata->w_package->adapter = data;
-	adata->w_package->next = (PackageData *)((char *)adata->w_package + size);
-	memcpy(&adata->w_package->header, data->buffer, len);
-	adata->w_package = adata->w_package->next;
-	adata->pack_count++;
-	ReleaseMutex(adata->mutex);
-	unlock_analyzer(adata);
+	uint8_t src = profiles[src_port];
+	uint8_t dst = profiles[dst_port];
+	// Выводится не больше, чем разрешает каждый из портов
+	uint8_t level = (src & PPROF_LOG_MASK) < (dst & PPROF_LOG_MASK) ?
+		src & PPROF_LOG_MASK : dst & PPROF_LOG_MASK;
+	return (dst & PPROF_ALLOWED) | (src & dst & PPROF_SCAN) | level;
 }
 
 AnalyzerList *create_analyzer(Bool lock)
 {
 	AnalyzerList *al = NULL;
+	Bool created = FALSE;
 	WaitForSingleObject(list_mutex, INFINITE);
 	if (alist_count < max_alist_count)
 	{
-		// Создание отдельного потока
-		al = (AnalyzerList *)malloc(sizeof(AnalyzerList));
-		alist_count++;
-		al->data.id = alist_count;
-		al->data.pack_count = 0;
-		al->data.read = FALSE;
+		// Повторно запускается анализатор, выведенный из работы
+		if (alist != NULL)
+		{
+			AnalyzerList *p = alist;
+			do
+			{
+				if (p->data.state == ASTATE_FREE)
+					al = p;
+				p = p->next;
+			}
+			while (p != alist && al == NULL);
+		}
+		if (al == NULL)
+		{
+			al = (AnalyzerList *)malloc(sizeof(AnalyzerList));
+			created = TRUE;
+			alist_nodes++;
+			al->data.id = alist_nodes;
+			al->data.group = get_thread_group(al->data.id - 1);
+			al->data.lock = TRUE;
+			al->data.event = CreateEvent(NULL, FALSE, FALSE, NULL);
+			al->data.head = 0;
+			al->data.written = 0;
+			al->data.pushed = 0;
+			al->data.finished = 0;
+			al->data.stolen = 0;
+			al->data.dropped = 0;
+			ZeroMemory(&al->data.merged, sizeof(NBCounters));
+			ZeroMemory(&al->data.counters, sizeof(NBCounters));
+			ZeroMemory(&al->data.merged_classes, sizeof(ClassCounters));
+			ZeroMemory(&al->data.classes, sizeof(ClassCounters));
+		}
+		al->data.parked = FALSE;
+		al->data.entries = (PackageData *)malloc(queue_size *
+			sizeof(PackageData));
+		// Счетчики взятых и записанных пакетов сохраняются, все записи
+		// свободны
+		al->data.reclaimed = al->data.written;
+		al->data.state = ASTATE_RUN;
+		MemoryBarrier();
 		al->data.lock = lock;
-		al->data.mutex = CreateMutex(NULL, FALSE, NULL);
-		al->data.buffer = (char *)malloc(analyzer_buffer_size);
-		al->data.r_package = (PackageData *)(PackageData *)al->data.buffer;
-		al->data.w_package = (PackageData *)(PackageData *)al->data.buffer;
-		al->data.r_package->adapter = NULL; // Как признак отсутствия пакета
-		al->hThread	= CreateThread(NULL, 0, an_thread, &al->data, 0, NULL);
-		if (al->hThread == NULL)
-			print_errlog("Failed to create thread!\n");
-		// Добавление его в циклический список
+		// Добавление его в циклический список до запуска потока: поток
+		// обходит список в поисках длинных очередей
 		if (alist == NULL)
 		{
 			alist = al;
 			alist->next = al;
+			al->data.next = &al->data;
 		}
-		else
+		else if (created)
 		{
 			al->next = alist->next;
+			al->data.next = &alist->next->data;
 			alist->next = al;
+			// Соседа читают без блокировки, поэтому ссылка на новый элемент
+			// появляется после заполнения его данных
+			__atomic_store_n(&alist->data.next, &al->data, __ATOMIC_RELEASE);
 			alist = alist->next;
 		}
+		// Создание отдельного потока
+		al->hThread	= CreateThread(NULL, 0, an_thread, &al->data, 0, NULL);
+		if (al->hThread == NULL)
+			print_errlog("Failed to create thread!\n");
+		char name[32];
+		snprintf(name, sizeof(name), "Analyzer #%u", al->data.id);
+		place_thread(al->hThread, TCLASS_ANALYZER, al->data.id - 1, name);
+		// Анализатор становится доступен для распределения по соединениям
+		// только после записи в таблицу
+		flow_analyzers[alist_count] = &al->data;
+		MemoryBarrier();
+		alist_count++;
 	}
 	else
 	{
@@ -257,229 +1565,446 @@ AnalyzerList *create_analyzer(Bool lock)
 	return al;
 }
 
-AnalyzerData *get_free_analyzer(size_t length)
+Bool retire_analyzer()
 {
-	AnalyzerList *p = alist;
-	AnalyzerList *al = NULL;
-	uint16_t filled_count = 0;
-	do
-	{	
-		char *buffer_top = (p->data.buffer + analyzer_buffer_size);
-		// Проверяем, что анализатор не заблокирован другим потоком
-		if (lock_analyzer(&p->data))
-		{	
-			char *r_cursor = (char *)p->data.r_package;
-			char *w_cursor = (char *)p->data.w_package;
-			// Ищем свободное место
-			if (r_cursor < w_cursor)
+	Bool retired = FALSE;
+	WaitForSingleObject(list_mutex, INFINITE);
+	for (int i = alist_count - 1; i >= 0 && !retired; i--)
+	{
+		AnalyzerData *adata = flow_analyzers[i];
+		// Анализатор, занятый производителем, не трогаем
+		if (lock_analyzer(adata))
+		{
+			flow_analyzers[i] = flow_analyzers[alist_count - 1];
+			alist_count--;
+			adata->state = ASTATE_DRAIN;
+			// Парный барьер к установке parked в an_thread
+			MemoryBarrier();
+			wake_analyzer(adata);
+			print_msglogf("Analyzer #%u is being retired.\n", adata->id);
+			retired = TRUE;
+		}
+	}
+	ReleaseMutex(list_mutex);
+	return retired;
+}
+
+AnalyzerData *get_analyzer(AdapterData *data, const char *buffer,
+	size_t count, uint8_t pclass)
+{
+	if (dispatch_mode == DMODE_FLOW)
+		return get_flow_analyzer(data, buffer, count, pclass);
+	return get_free_analyzer(data, 1, pclass);
+}
+
+AnalyzerData *get_flow_analyzer(AdapterData *data, const char *buffer,
+	size_t count, uint8_t pclass)
+{
+	uint32_t hash = get_flow_hash(buffer, count);
+	DWORD start = 0;
+	while (TRUE)
+	{
+		// Таблица меняется при выводе анализаторов из работы
+		AnalyzerData *adata = flow_analyzers[hash % alist_count];
+		// Другой производитель занимает анализатор только на время записи
+		if (!lock_analyzer(adata))
+			YieldProcessor();
+		else if (reserve_space(adata, get_class_length(1, pclass)))
+			return adata;
+		else
+		{
+			if (flow_fallback == FFALLBACK_FREE)
 			{
-				// После указателя записи
-				if (length <= (buffer_top - w_cursor))
-					al = p;
-				// Перед указателем чтения
-				else if (length <= r_cursor - p->data.buffer)
-				{
-					al = p;
-					// Поиск последнего пакета
-					PackageData *pd = al->data.r_package;
-					while (pd->next != al->data.w_package)
-						pd = pd->next;
-					// Сброс записи на начало буфера
-					al->data.w_package = (PackageData *)al->data.buffer; 
-					pd->next = al->data.w_package;
-				}
-					
+				unlock_analyzer(adata);
+				return get_free_analyzer(data, 1, pclass);
 			}
-			else if (r_cursor > w_cursor)
+			// Порядок пакетов соединения сохраняется, поэтому место ищется
+			// только у его анализатора
+			if (overflow_policy == OPOLICY_DROP_OLDEST)
+				return drop_oldest(adata, 1);
+			unlock_analyzer(adata);
+			if (overflow_policy != OPOLICY_BLOCK || !wait_for_space(&start))
 			{
-				// Между указателями
-				if (length <= r_cursor - w_cursor)
-					al = p;
+				InterlockedIncrement(&adata->dropped);
+				return NULL;
 			}
-			else 
+		}
+	}
+}
+
+uint32_t get_flow_hash(const char *buffer, size_t count)
+{
+	const IPHeader *package = (const IPHeader *)buffer;
+	// Адреса и порты упорядочиваются, чтобы оба направления совпали
+	uint32_t a = package->src;
+	uint32_t b = package->dst;
+	if (a > b)
+	{
+		a = package->dst;
+		b = package->src;
+	}
+	uint32_t ports = 0;
+	size_t shift = (package->ver_len & 0x0F) << 2;
+	// Порты есть только в первом фрагменте
+	if ((package->protocol == IPPROTO_TCP || package->protocol == IPPROTO_UDP)
+		&& (ntohs(package->offset) & 0x1FFF) == 0 && shift + 4 <= count)
+	{
+		uint16_t src_port = *(const uint16_t *)(buffer + shift);
+		uint16_t dst_port = *(const uint16_t *)(buffer + shift + 2);
+		ports = src_port < dst_port ? (uint32_t)src_port << 16 | dst_port :
+			(uint32_t)dst_port << 16 | src_port;
+	}
+	uint32_t hash = (a * 0x9E3779B1) ^ (b * 0x85EBCA6B) ^
+		(ports * 0xC2B2AE35) ^ package->protocol;
+	return hash ^ (hash >> 16);
+}
+
+AnalyzerData *get_free_analyzer(AdapterData *data, uint32_t count,
+	uint8_t pclass)
+{
+	DWORD start = 0;
+	uint32_t need = get_class_length(count, pclass);
+	while (TRUE)
+	{
+		// Приоритетные пакеты попадают в самую короткую очередь
+		AnalyzerData *adata = pclass == PCLASS_PRIORITY ?
+			find_shortest_analyzer(count) : NULL;
+		if (adata == NULL)
+			adata = find_free_analyzer(need, data->group);
+		if (adata != NULL)
+			return adata;
+		// Пул расширяется, пока не достигнут максимум
+		if (alist_count < max_alist_count)
+		{
+			AnalyzerList *al = create_analyzer(TRUE);
+			if (al != NULL)
 			{
-				// Если указывает на обработанный пакет
-				if (p->data.r_package->adapter == NULL)
-					al = p;
+				if (reserve_space(&al->data, count))
+					return &al->data;
+				unlock_analyzer(&al->data);
 			}
 		}
-		// Создаем новый анализатор, если не получилось найти свободный	
-		if (al == NULL)
+		if (overflow_policy == OPOLICY_DROP_OLDEST)
+			return drop_oldest(NULL, need);
+		if (overflow_policy != OPOLICY_BLOCK || !wait_for_space(&start))
+			return NULL;
+	}
+}
+
+AnalyzerData *find_shortest_analyzer(uint32_t count)
+{
+	AnalyzerList *p = alist;
+	AnalyzerData *data = NULL;
+	uint32_t min_backlog = UINT32_MAX;
+	do
+	{
+		uint32_t backlog = get_backlog(&p->data);
+		if (p->data.state == ASTATE_RUN && backlog < min_backlog)
+		{
+			min_backlog = backlog;
+			data = &p->data;
+		}
+		p = p->next;
+	}
+	while (p != alist);
+	if (data == NULL || !lock_analyzer(data))
+		return NULL;
+	if (reserve_space(data, count))
+		return data;
+	unlock_analyzer(data);
+	return NULL;
+}
+
+uint32_t get_class_length(uint32_t count, uint8_t pclass)
+{
+	// Если с резервом место не найти никогда, резерв не учитывается
+	if (pclass == PCLASS_PRIORITY || count + priority_headroom > queue_size)
+		return count;
+	return count + priority_headroom;
+}
+
+uint8_t get_package_class(const char *buffer, size_t count)
+{
+	const IPHeader *package = (const IPHeader *)buffer;
+	if (package->protocol == IPPROTO_ICMP)
+		return PCLASS_PRIORITY;
+	size_t shift = (package->ver_len & 0x0F) << 2;
+	// Порты есть только в первом фрагменте
+	if ((ntohs(package->offset) & 0x1FFF) != 0 || shift + 4 > count)
+		return PCLASS_BULK;
+	uint16_t dst_port = *(const uint16_t *)(buffer + shift + 2);
+	if (package->protocol == IPPROTO_TCP)
+	{
+		const TCPHeader *tcp = (const TCPHeader *)(buffer + shift);
+		// Открытие соединения
+		if (shift + sizeof(TCPHeader) <= count && tcp->flags == SYN_FTCP)
+			return PCLASS_PRIORITY;
+		if (!(tcp_profiles[dst_port] & PPROF_ALLOWED))
+			return PCLASS_PRIORITY;
+	}
+	else if (package->protocol == IPPROTO_UDP &&
+		!(udp_profiles[dst_port] & PPROF_ALLOWED))
+		return PCLASS_PRIORITY;
+	return PCLASS_BULK;
+}
+
+Bool is_share_exceeded(AdapterData *data)
+{
+	LONG queued = data->queued[PCLASS_PRIORITY] + data->queued[PCLASS_BULK];
+	if (queued <= (LONG)fair_backlog)
+		return FALSE;
+	// Доли считаются только среди адаптеров, пакеты которых есть в очередях
+	uint64_t total = 0;
+	uint64_t weights = 0;
+	for (AdapterData *p = adapters; p != NULL; p = p->next)
+	{
+		LONG q = p->queued[PCLASS_PRIORITY] + p->queued[PCLASS_BULK];
+		if (q > 0)
 		{
-			filled_count++;
-			unlock_analyzer(&p->data);
-			if (p->next == alist)
+			total += q;
+			weights += p->weight;
+		}
+	}
+	// Пока очереди не перегружены, места хватает всем
+	if (total <= (uint64_t)fair_backlog * alist_count)
+		return FALSE;
+	return (uint64_t)queued * weights > (uint64_t)data->weight * total;
+}
+
+AnalyzerData *find_free_analyzer(uint32_t count, uint32_t group)
+{
+	// Пакеты остаются в кэше, общем с приёмом адаптера, пока у его
+	// анализаторов есть место
+	for (int near = group != THREAD_GROUP_ANY; near >= 0; near--)
+	{
+		AnalyzerList *p = alist;
+		do
+		{
+			// Проверяем, что анализатор не заблокирован другим потоком
+			if ((group == THREAD_GROUP_ANY ||
+				(p->data.group == group) == near) && lock_analyzer(&p->data))
 			{
-				al = create_analyzer(TRUE);
-				// Если нельзя больше создавать анализаторы из-за ограничения
-				// и все анализаторы полностью заполненные
-				if (al == NULL && filled_count == alist_count)
-				{
-					print_msglog("Search analyzer to reset.\n");
-					do
-					{
-						if (lock_analyzer(&p->data))
-						{
-							// Проверка доступности сброса
-							char *next = (char *)p->data.r_package->next;
-							if (length <= buffer_top - next)
-							{
-								al = p;
-								// Сброс записи на начало буфера
-								al->data.w_package = al->data.r_package->next;
-								WaitForSingleObject(al->data.mutex, INFINITE);
-								if (al->data.read)
-									al->data.pack_count = 1;
-								else
-									al->data.pack_count = 0;
-								ReleaseMutex(al->data.mutex);
-								print_msglogf("Analyzer #%u has been reset.\n", 
-									al->data.id);
-							}
-							else
-								unlock_analyzer(&p->data);
-						}
-						p = p->next;
-					}
-					while (al == NULL);
-				}
+				if (reserve_space(&p->data, count))
+					return &p->data;
+				unlock_analyzer(&p->data);
 			}
+			p = p->next;
 		}
-		p = p->next;
+		while (p != alist);
 	}
-	while (al == NULL);
-	return &al->data;
+	return NULL;
 }
 
-void analyze_tcp(PackageData *pd)
+AnalyzerData *drop_oldest(AnalyzerData *data, uint32_t count)
 {
-	PackageInfo info = get_ip_info(pd);
-	info.data  = (char *)&pd->header;
-	// Получаем заголовок протокола
-	TCPHeader *tcp = (TCPHeader *)(info.data + info.shift);
-	info.shift += (tcp->length & 0xF0) >> 2;
-	// Сбор статистики
-	WaitForSingleObject(stat_mutex, INFINITE);
-	stats->tcp_count++;
-	// флаги
-	if (tcp->flags == SYN_FTCP && stats->syn_count < 65535)
+	if (data == NULL)
+	{
+		// Пакеты отбрасываются у анализатора с самой длинной очередью
+		AnalyzerList *p = alist;
+		uint32_t max_backlog = 0;
+		do
+		{
+			uint32_t backlog = get_backlog(&p->data);
+			if (p->data.state == ASTATE_RUN && backlog > max_backlog)
+			{
+				max_backlog = backlog;
+				data = &p->data;
+			}
+			p = p->next;
+		}
+		while (p != alist);
+		if (data == NULL || !lock_analyzer(data))
+			return NULL;
+	}
+	uint32_t freed = 0;
+	while (!reserve_space(data, count))
 	{
-		stats->syn_count++;
-		add_syn_tcp_list(pd->header.src);
+		// Если места не хватает и после отброшенных пакетов, его держит
+		// пачка, которую анализатор проверяет в данный момент
+		uint32_t first;
+		uint32_t claimed = freed < count ?
+			claim_packages(data, drain_batch, &first) : 0;
+		if (claimed == 0)
+		{
+			unlock_analyzer(data);
+			return NULL;
+		}
+		freed += process_packages(data, first, claimed, NULL);
 	}
-	else if (tcp->flags == ACK_FTCP && stats->ask_sa_count < 65535)
+	return data;
+}
+
+Bool wait_for_space(DWORD *start)
+{
+	DWORD now = GetTickCount();
+	if (*start == 0)
+		*start = now | 1;
+	DWORD elapsed = now - *start;
+	if (elapsed >= block_timeout)
+		return FALSE;
+	// Ожидание отрезками по 1 мс: сигнал, поданный до отметки об
+	// ожидании, теряется
+	InterlockedIncrement(&space_waiters);
+	WaitForSingleObject(space_event, 1);
+	InterlockedDecrement(&space_waiters);
+	return TRUE;
+}
+
+void count_dropped(AdapterData *data, uint32_t count)
+{
+	InterlockedExchangeAdd(&data->dropped, count);
+	InterlockedExchangeAdd(&data->lost, count);
+}
+
+Bool reserve_space(AnalyzerData *data, uint32_t count)
+{
+	// Записи освобождаются по порядку, когда проверены все пакеты до них
+	uint32_t head = (uint32_t)__atomic_load_n(&data->head, __ATOMIC_ACQUIRE);
+	while (data->reclaimed != head && __atomic_load_n(
+		&data->entries[data->reclaimed & queue_mask].adapter,
+		__ATOMIC_ACQUIRE) == NULL)
+		data->reclaimed++;
+	return count <= queue_size - (data->written - data->reclaimed);
+}
+
+void decode_package(PackageData *pd, PackageEntry *pe, PackageInfo *info,
+	const char *time_buff)
+{
+	IPHeader *package = pd->package;
+	pe->package = package;
+	// Запись идентификатор на файл
+	info->fid = pd->adapter->fid;
+	memcpy(info->time_buff, time_buff, sizeof(info->time_buff));
+	// Получение адресов
+	IN_ADDR in_addr;
+	in_addr.s_addr = package->src;
+	strcpy(info->src_buff, inet_ntoa(in_addr));
+	in_addr.s_addr = package->dst;
+	strcpy(info->dst_buff, inet_ntoa(in_addr));
+	// Определение размера
+	info->size = ntohs(package->length);
+	// Получаем заголовок протокола и смещение до данных
+	info->shift = sizeof(IPHeader);
+	pe->header = (char *)package + info->shift;
+	pe->profile = PPROF_DEFAULT;
+	if (package->protocol == IPPROTO_TCP)
 	{
-		if (remove_syn_tcp_list(pd->header.src))
-			stats->ask_sa_count++;
+		TCPHeader *tcp = (TCPHeader *)pe->header;
+		info->shift += (tcp->length & 0xF0) >> 2;
+		pe->profile = get_port_profile(tcp_profiles, tcp->src_port,
+			tcp->dst_port);
 	}
-	else if (tcp->flags == FIN_FTCP && stats->fin_count < 65535)
-		stats->fin_count++;
-	else if (tcp->flags == RST_FTCP && stats->rst_count < 65535)
-		stats->rst_count++;
-	// порты
-	if (contain_in_plist(tcp_ports, tcp->dst_port))
+	else if (package->protocol == IPPROTO_UDP)
 	{
-		if (stats->al_tcp_port_count < 65535)
-			stats->al_tcp_port_count++;
+		UDPHeader *udp = (UDPHeader *)pe->header;
+		info->shift += sizeof(UDPHeader);
+		pe->profile = get_port_profile(udp_profiles, udp->src_port,
+			udp->dst_port);
 	}
+	else if (package->protocol == IPPROTO_ICMP)
+		info->shift += sizeof(ICMPHeader);
 	else
-	{
-		if (stats->un_tcp_port_count < 65535)
-			stats->un_tcp_port_count++;
-	}	
-	is_stats_changed = TRUE;
-	ReleaseMutex(stat_mutex);	
-	// Определяем флаги
-	char flags[7] = "UAPRSF";
-	for (int i = 0; i < 6; i++)
-		if ((tcp->flags & 0x20 >> i) == 0)
-			flags[i] = '_';
+		pe->header = NULL;
 	// Переход к данным
-	info.data += info.shift;
-	// Анализ содержимого пакета
-	analyze_data(&info);
-	// Вывод в файл
-	log_package(&info, get_format(TCP),
-		info.time_buff, flags,
-		info.src_buff, ntohs(tcp->src_port),
-		info.dst_buff, ntohs(tcp->dst_port),
-		info.size);
-}
-
-void analyze_udp(PackageData *pd)
-{
-	PackageInfo info = get_ip_info(pd);
-	info.data = (char *)&pd->header;
-	// Получаем заголовок протокола
-	UDPHeader *udp = (UDPHeader *)(info.data + info.shift);
-	info.shift += sizeof(UDPHeader);
-	// Сбор статистики
-	WaitForSingleObject(stat_mutex, INFINITE);
-	stats->udp_count++;
-	// порты
-	if (contain_in_plist(udp_ports, udp->dst_port))
-	{
-		if (stats->al_udp_port_count < 65535)
-			stats->al_udp_port_count++;
+	info->data = (char *)package + info->shift;
+}
+
+void update_stats(NBCounters *counters, PackageDesc **descs, uint32_t count)
+{
+	// Часть таблицы соединений освобождается, только когда сегмент попал
+	// в другую часть, и в конце пачки
+	ConnStripe *locked = NULL;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		PackageEntry *pe = &descs[i]->entry;
+		IPHeader *package = pe->package;
+		pe->flow = CONN_NONE;
+		if (package->protocol == IPPROTO_TCP)
+		{
+			TCPHeader *tcp = (TCPHeader *)pe->header;
+			counters->tcp_count++;
+			// соединения
+			uint8_t events;
+			pe->flow = track_connection(package->src, package->dst,
+				tcp->src_port, tcp->dst_port, tcp->flags, &locked, &events);
+			if (events & CEVENT_OPENED)
+				counters->syn_count++;
+			if (events & CEVENT_ESTABLISHED)
+				counters->ask_sa_count++;
+			if (events & CEVENT_CLOSED)
+				counters->fin_count++;
+			if (events & CEVENT_RESET)
+				counters->rst_count++;
+			// порты
+			if (pe->profile & PPROF_ALLOWED)
+				counters->al_tcp_port_count++;
+			else
+				counters->un_tcp_port_count++;
+		}
+		else if (package->protocol == IPPROTO_UDP)
+		{
+			counters->udp_count++;
+			// порты
+			if (pe->profile & PPROF_ALLOWED)
+				counters->al_udp_port_count++;
+			else
+				counters->un_udp_port_count++;
+		}
+		else if (package->protocol == IPPROTO_ICMP)
+			counters->icmp_count++;
+		else
+			counters->ip_count++;
 	}
+	release_conn_stripe(locked);
+}
+
+void check_entry(PackageEntry *pe, PackageInfo *info)
+{
+	// Данные TCP проверяются с учетом предыдущего сегмента
+	if (pe->package->protocol == IPPROTO_TCP)
+		analyze_stream(info, pe->package, (TCPHeader *)pe->header, pe->flow);
 	else
+		analyze_data(info);
+}
+
+void format_entry(const PackageEntry *pe, PackageLog *log)
+{
+	const PackageInfo *info = &log->info;
+	uint8_t protocol = pe->package->protocol;
+	if (protocol == IPPROTO_TCP)
 	{
-		if (stats->un_udp_port_count < 65535)
-			stats->un_udp_port_count++;
-	}	
-	is_stats_changed = TRUE;
-	ReleaseMutex(stat_mutex);
-	// Переход к данным
-	info.data += info.shift;
-	// Анализ содержимого пакета
-	analyze_data(&info);
-	// Вывод в файл
-	log_package(&info, get_format(UDP), info.time_buff,
-		info.src_buff, ntohs(udp->src_port),
-		info.dst_buff, ntohs(udp->dst_port),
-		info.size);
-}
-
-void analyze_icmp(PackageData *pd)
-{
-	PackageInfo info = get_ip_info(pd);
-	info.data = (char *)&pd->header;
-	// Получаем заголовок протокола
-	ICMPHeader *icmp = (ICMPHeader *)(info.data + info.shift);
-	info.shift += sizeof(ICMPHeader);
-	// Сбор статистики
-	WaitForSingleObject(stat_mutex, INFINITE);
-	stats->icmp_count++;
-	is_stats_changed = TRUE;
-	ReleaseMutex(stat_mutex);	
-	// Переход к данным
-	info.data += info.shift;
-	// Анализ содержимого пакета
-	analyze_data(&info);
-	// Вывод в файл
-	log_package(&info, get_format(ICMP),
-		info.time_buff, icmp->type, icmp->code,
-		info.src_buff, info.dst_buff, info.size);
-}
-
-void analyze_ip(PackageData *pd)
-{
-	PackageInfo info = get_ip_info(pd);
-	info.data = (char *)(&pd->header);
-	info.data += info.shift;
-	// Сбор статистики
-	WaitForSingleObject(stat_mutex, INFINITE);
-	stats->ip_count++;
-	is_stats_changed = TRUE;
-	ReleaseMutex(stat_mutex);
-	// Переход к данным
-	info.data += info.shift;
-	// Анализ содержимого пакета
-	analyze_data(&info);
-	// Вывод в файл
-	log_package(&info, get_format(IP),
-		info.time_buff, get_protocol_name(pd->header.protocol),
-		info.src_buff, info.dst_buff, info.size);
+		TCPHeader *tcp = (TCPHeader *)pe->header;
+		// Определяем флаги
+		char flags[7] = "UAPRSF";
+		for (int i = 0; i < 6; i++)
+			if ((tcp->flags & 0x20 >> i) == 0)
+				flags[i] = '_';
+		snprintf(log->header, sizeof(log->header), get_format(TCP),
+			info->time_buff, flags,
+			info->src_buff, ntohs(tcp->src_port),
+			info->dst_buff, ntohs(tcp->dst_port),
+			info->size);
+	}
+	else if (protocol == IPPROTO_UDP)
+	{
+		UDPHeader *udp = (UDPHeader *)pe->header;
+		snprintf(log->header, sizeof(log->header), get_format(UDP),
+			info->time_buff,
+			info->src_buff, ntohs(udp->src_port),
+			info->dst_buff, ntohs(udp->dst_port),
+			info->size);
+	}
+	else if (protocol == IPPROTO_ICMP)
+	{
+		ICMPHeader *icmp = (ICMPHeader *)pe->header;
+		snprintf(log->header, sizeof(log->header), get_format(ICMP),
+			info->time_buff, icmp->type, icmp->code,
+			info->src_buff, info->dst_buff, info->size);
+	}
+	else
+		snprintf(log->header, sizeof(log->header), get_format(IP),
+			info->time_buff, get_protocol_name(protocol),
+			info->src_buff, info->dst_buff, info->size);
 }
 
 void analyze_data(PackageInfo *info)
@@ -500,142 +2025,160 @@ void analyze_data(PackageInfo *info)
 	}
 }
 
-PackageInfo get_ip_info(PackageData *pd)
+uint8_t swap_stream_tail(IPHeader *package, TCPHeader *tcp, uint32_t flow,
+	const char *buf, uint32_t len, char *joint)
 {
-	PackageInfo info;
-	// Запись идентификатор на файл
-	info.fid = pd->adapter->fid;
-	// Получение текущего времени
-	get_localtime(info.time_buff);
-	// Получение адресов
-	IN_ADDR in_addr;
-	in_addr.s_addr = pd->header.src;
-	strcpy(info.src_buff, inet_ntoa(in_addr));
-	in_addr.s_addr = pd->header.dst;
-	strcpy(info.dst_buff, inet_ntoa(in_addr));
-	// Определение размера
-	info.size = ntohs(pd->header.length);
-	// Определение смещения
-	info.shift = sizeof(IPHeader);
-	return info;
+	uint8_t tail_len = 0;
+	uint32_t seq = ntohl(tcp->seq_num);
+	// Направление известного соединения уже определяет запись
+	uint32_t hash = flow;
+	if (flow == CONN_NONE)
+		hash = (package->src * 0x9E3779B1) ^ (package->dst * 0x85EBCA6B) ^
+			(((uint32_t)tcp->src_port << 16 | tcp->dst_port) * 0xC2B2AE35);
+	// Записи разных частей таблицы меняются параллельно
+	uint32_t index = hash % stream_tail_count;
+	CRITICAL_SECTION *lock = &stream_locks[index & (STREAM_LOCK_COUNT - 1)];
+	EnterCriticalSection(lock);
+	StreamTail *st = (StreamTail *)(stream_tails +
+		(size_t)index * stream_tail_size);
+	Bool same = st->src == package->src && st->dst == package->dst &&
+		st->src_port == tcp->src_port && st->dst_port == tcp->dst_port;
+	// Склейка возможна только с непосредственно предшествующим сегментом
+	if (same && st->next_seq == seq)
+	{
+		tail_len = st->len;
+		memcpy(joint, st->data, tail_len);
+	}
+	// Запись занимает поток, сегмент которого пришел последним
+	st->src = package->src;
+	st->dst = package->dst;
+	st->src_port = tcp->src_port;
+	st->dst_port = tcp->dst_port;
+	st->next_seq = seq + len;
+	st->len = update_tail(st->data, tail_len, buf, len);
+	LeaveCriticalSection(lock);
+	return tail_len;
 }
 
-Bool lock_analyzer(AnalyzerData *data)
+void analyze_stream(PackageInfo *info, IPHeader *package, TCPHeader *tcp,
+	uint32_t flow)
 {
-	Bool l = FALSE;
-	WaitForSingleObject(lock_mutex, INFINITE);
-	// Проверяем, что анализатор свободен
-	if (!data->lock)
+	if (stream_tails != NULL && info->size > info->shift)
 	{
-		data->lock = TRUE;
-		l = TRUE;
+		char joint[2 * UINT8_MAX];
+		uint32_t len = info->size - info->shift;
+		uint8_t tail_len = swap_stream_tail(package, tcp, flow, info->data, len,
+			joint);
+		if (tail_len > 0)
+		{
+			uint32_t joint_len = make_joint(joint, tail_len, info->data, len);
+			if (work_mode == WMODE_STUD)
+				break_joint_into_patterns(joint, joint_len, tail_len);
+			else
+			{
+				PackAnomaly *pa = check_joint(joint, joint_len, tail_len);
+				if (pa != NULL)
+				{
+					report_pa(pa, info);
+					free(pa);
+					return;
+				}
+			}
+		}
 	}
-	ReleaseMutex(lock_mutex);
-	return l;
+	analyze_data(info);
 }
 
-void unlock_analyzer(AnalyzerData *data)
+Bool lock_analyzer(AnalyzerData *data)
 {
-	WaitForSingleObject(lock_mutex, INFINITE);
-	data->lock = FALSE;
-	ReleaseMutex(lock_mutex);
+	// Проверяем, что анализатор свободен, и занимаем его одной операцией
+	return !data->lock &&
+		InterlockedCompareExchange(&data->lock, TRUE, FALSE) == FALSE;
 }
 
-void add_syn_tcp_list(uint32_t src)
+void unlock_analyzer(AnalyzerData *data)
 {
-	SynTCPList *p = beg_synlist;
-	// Попытка найти в списке
-	while (p != NULL)
-		if (p->src == src)
-		{
-			if (p->count < 65535)
-				p->count++;
-			break;
-		}			
-		else
-			p = p->next;
+	InterlockedExchange(&data->lock, FALSE);
+}
 
-	if (p == NULL)
+DWORD WINAPI an_thread(LPVOID ptr)
+{
+	AnalyzerData *data = (AnalyzerData *)ptr;
+	print_msglogf("Analyzer #%u launched\n", data->id);
+	uint32_t spins = 0;
+	// Пачка забирается из очереди целиком и передается этапам проверки
+	AnalyzerBatch batch;
+	alloc_batch(&batch, &data->counters, &data->classes);
+	// Выводимый из работы анализатор завершается, когда проверены все его
+	// пакеты, в том числе забранные другими анализаторами
+	while (data->state == ASTATE_RUN || data->finished != data->pushed)
 	{
-		p = (SynTCPList *)malloc(sizeof(SynTCPList));
-		p->src = src;
-		p->count = 1;
-		p->next = NULL;
-		// Добавление его в список
-		if (beg_synlist == NULL)
+		uint32_t first;
+		uint32_t count = work_mode != WMODE_PASS ?
+			claim_packages(data, drain_batch, &first) : 0;
+		if (count > 0)
+		{
+			spins = 0;
+			process_packages(data, first, count, &batch);
+		}
+		// Пока своя очередь пуста, помогаем загруженным анализаторам
+		else if (work_mode != WMODE_PASS && steal_batch > 0 &&
+			data->state == ASTATE_RUN && (spins == 0 || spins == spin_count) &&
+			steal_packages(data, &batch) > 0)
+			spins = 0;
+		// Короткое ожидание без системных вызовов для низкой задержки
+		else if (spins < spin_count)
 		{
-			beg_synlist = p;
-			end_synlist = p;
+			spins++;
+			YieldProcessor();
 		}
 		else
 		{
-			end_synlist->next = p;
-			end_synlist = p;
+			// Поток засыпает до сигнала производителя; в пассивном режиме
+			// очередь не разбирается, поэтому режим проверяется периодически
+			InterlockedExchange(&data->parked, TRUE);
+			Bool idle = get_backlog(data) == 0 && data->state == ASTATE_RUN;
+			WaitForSingleObject(data->event, idle ? INFINITE : 100);
+			InterlockedExchange(&data->parked, FALSE);
+			spins = 0;
 		}
 	}
+	free_batch(&batch);
+	flush_slot_cache();
+	// Записи очереди освобождает поток изменения количества анализаторов
+	data->state = ASTATE_DONE;
+	print_msglogf("Analyzer #%u stopped\n", data->id);
+	return 0;
 }
 
-Bool remove_syn_tcp_list(uint32_t src)
+DWORD WINAPI stage_thread(LPVOID ptr)
 {
-	Bool res = FALSE;
-	SynTCPList *p = beg_synlist;
-	if (p != NULL)
+	StageThread *st = (StageThread *)ptr;
+	uint32_t spins = 0;
+	AnalyzerBatch batch;
+	alloc_batch(&batch, &st->counters, NULL);
+	while (TRUE)
 	{
-		SynTCPList *pred = NULL; 
-		// Поиск нужного адреса
-		while (p != NULL && p->src != src)
+		uint32_t count = pop_stage(&st->queue, (void **)batch.descs,
+			check_batch_size);
+		if (count > 0)
 		{
-			pred = p;
-			p = p->next;
+			spins = 0;
+			run_stage(st->stage, batch.descs, count, &batch);
 		}
-		if (p != NULL && p->count > 0)
+		// Короткое ожидание без системных вызовов для низкой задержки
+		else if (spins < spin_count)
 		{
-			p->count--;
-			res = TRUE;
-			if (p->count == 0)
-			{
-				if (pred == NULL)
-					beg_synlist = beg_synlist->next;
-				else
-					pred->next = p->next;
-				free(p);
-				p = NULL;
-			}
+			spins++;
+			YieldProcessor();
 		}
-	}
-}
-
-DWORD WINAPI an_thread(LPVOID ptr)
-{
-	AnalyzerData *data = (AnalyzerData *)ptr;
-	print_msglogf("Analyzer #%u launched\n", data->id);
-	while (TRUE)
-	{
-		if (data->pack_count && work_mode > 0)
+		else
 		{
-			data->read = TRUE;
-			PackageData *pd = data->r_package;
-			// Определение типа протокола для уточнения анализа
-			if (work_mode != WMODE_PASS)
-			{
-				if (pd->header.protocol == IPPROTO_TCP)
-					analyze_tcp(pd);
-				else if (pd->header.protocol == IPPROTO_UDP)
-					analyze_udp(pd);
-				else if (pd->header.protocol == IPPROTO_ICMP)
-					analyze_icmp(pd);
-				else
-					analyze_ip(pd);
-			}
-			// Отмечаем, что пакет проверен
-			pd->adapter = NULL; 
-			data->r_package = pd->next;
-			WaitForSingleObject(data->mutex, INFINITE);
-			data->pack_count--;
-			data->read = FALSE;
-			ReleaseMutex(data->mutex);
+			park_stage(&st->queue);
+			spins = 0;
 		}
 	}
+	return 0;
 }
 
 DWORD WINAPI sd_thread(LPVOID ptr)
@@ -666,7 +2209,7 @@ DWORD WINAPI stats_thread(LPVOID ptr)
 	{
 		Sleep(stat_col_period * 1000);
 		// Запись текущей статистики в лог
-		if (is_stats_changed)
+		if (merge_stats())
 		{
 			// Получение времени
 			char time_buff[9];
@@ -678,7 +2221,9 @@ DWORD WINAPI stats_thread(LPVOID ptr)
 				stats->syn_count, stats->ask_sa_count,
 				stats->fin_count, stats->rst_count,
 				stats->al_tcp_port_count, stats->un_tcp_port_count,
-				stats->al_udp_port_count, stats->un_udp_port_count);
+				stats->al_udp_port_count, stats->un_udp_port_count,
+				take_dedup_hits());
+			log_analyzers();
 			if (work_mode == WMODE_STUD)
 				// Добавление новой статистики, для сохранения предыдущей
 				stats = get_statistics();
@@ -690,7 +2235,172 @@ DWORD WINAPI stats_thread(LPVOID ptr)
 					report_sa(sa);
 				ZeroMemory(stats, sizeof(NBStats));
 			}
-			is_stats_changed = FALSE;
+		}
+	}
+}
+
+Bool merge_stats()
+{
+	if (alist == NULL)
+		return FALSE;
+	Bool is_changed = FALSE;
+	WaitForSingleObject(list_mutex, INFINITE);
+	AnalyzerList *p = alist;
+	do
+	{
+		if (merge_counters(&p->data.counters, &p->data.merged))
+			is_changed = TRUE;
+		merge_classes(&p->data);
+		p = p->next;
+	}
+	while (p != alist);
+	ReleaseMutex(list_mutex);
+	// Статистику собирают и потоки этапа, если он выполняется отдельно
+	for (uint32_t i = 0; i < stage_thread_count[STAGE_STATS]; i++)
+		if (merge_counters(&stage_threads[STAGE_STATS][i].counters,
+			&stage_threads[STAGE_STATS][i].merged))
+			is_changed = TRUE;
+	return is_changed;
+}
+
+Bool merge_counters(NBCounters *counters, NBCounters *merged)
+{
+	Bool is_changed = FALSE;
+	VectorType *res = (VectorType *)stats;
+	volatile uint32_t *values = (volatile uint32_t *)counters;
+	uint32_t *prev = (uint32_t *)merged;
+	for (int i = 0; i < PARAM_NBSTATISTICS_COUNT; i++)
+	{
+		// Счетчик потока не сбрасывается, поэтому приращение верно
+		// и после переполнения
+		uint32_t value = values[i];
+		uint32_t delta = value - prev[i];
+		prev[i] = value;
+		if (delta > 0)
+		{
+			res[i] = delta < 65535u - res[i] ? res[i] + delta : 65535;
+			is_changed = TRUE;
+		}
+	}
+	return is_changed;
+}
+
+void merge_classes(AnalyzerData *data)
+{
+	ClassCounters *classes = &data->classes;
+	ClassCounters *merged = &data->merged_classes;
+	for (int c = 0; c < PCLASS_COUNT; c++)
+	{
+		uint32_t checked = *(volatile uint32_t *)&classes->checked[c];
+		uint32_t wait = *(volatile uint32_t *)&classes->wait[c];
+		class_checked[c] += checked - merged->checked[c];
+		class_wait[c] += wait - merged->wait[c];
+		merged->checked[c] = checked;
+		merged->wait[c] = wait;
+		uint32_t max_wait = InterlockedExchange(&classes->max_wait[c], 0);
+		if (max_wait > class_max_wait[c])
+			class_max_wait[c] = max_wait;
+	}
+}
+
+void log_analyzers()
+{
+	if (alist == NULL)
+		return;
+	WaitForSingleObject(list_mutex, INFINITE);
+	AnalyzerList *p = alist;
+	do
+	{
+		if (p->data.state != ASTATE_FREE)
+			log_stats(get_format(ANALYZER), p->data.id, get_backlog(&p->data),
+				(uint32_t)InterlockedExchange(&p->data.stolen, 0),
+				(uint32_t)InterlockedExchange(&p->data.dropped, 0));
+		p = p->next;
+	}
+	while (p != alist);
+	for (AdapterData *ad = adapters; ad != NULL; ad = ad->next)
+		log_stats(get_format(ADAPTER), ad->addr,
+			(uint32_t)InterlockedExchange(&ad->dropped, 0));
+	const char *class_names[PCLASS_COUNT] = { "priority", "bulk" };
+	for (int c = 0; c < PCLASS_COUNT; c++)
+	{
+		// Глубина - пакеты класса, стоящие в очередях сейчас
+		LONG depth = 0;
+		for (AdapterData *ad = adapters; ad != NULL; ad = ad->next)
+			depth += ad->queued[c];
+		log_stats(get_format(CLASS), class_names[c], (uint32_t)depth,
+			class_checked[c] > 0 ? class_wait[c] / class_checked[c] : 0,
+			class_max_wait[c]);
+		class_checked[c] = 0;
+		class_wait[c] = 0;
+		class_max_wait[c] = 0;
+	}
+	uint32_t active, expired;
+	take_conn_stats(&active, &expired);
+	log_stats(get_format(CONN), active, expired);
+	log_stats("\n");
+	ReleaseMutex(list_mutex);
+}
+
+DWORD WINAPI sc_thread(LPVOID ptr)
+{
+	uint32_t last_finished = 0;
+	uint32_t calm_periods = 0;
+	while (TRUE)
+	{
+		Sleep(scale_period);
+		if (alist == NULL)
+			continue;
+		uint32_t backlog = 0;
+		uint32_t finished = 0;
+		WaitForSingleObject(list_mutex, INFINITE);
+		AnalyzerList *p = alist;
+		do
+		{
+			// Записи освобождаются через период после завершения потока,
+			// чтобы их не читал анализатор, начавший забирать пакеты раньше
+			if (p->data.state == ASTATE_GRACE)
+			{
+				free(p->data.entries);
+				p->data.entries = NULL;
+				CloseHandle(p->hThread);
+				p->data.state = ASTATE_FREE;
+				print_msglogf("Analyzer #%u has been retired.\n", p->data.id);
+			}
+			else if (p->data.state == ASTATE_DONE)
+				p->data.state = ASTATE_GRACE;
+			backlog += get_backlog(&p->data);
+			finished += (uint32_t)p->data.finished;
+			p = p->next;
+		}
+		while (p != alist);
+		uint16_t count = alist_count;
+		ReleaseMutex(list_mutex);
+		uint32_t done = finished - last_finished;
+		last_finished = finished;
+		// В пассивном режиме очереди не разбираются
+		if (work_mode == WMODE_PASS)
+			continue;
+		// Время ожидания в очереди при скорости проверки за период
+		uint32_t wait = backlog > 0 ? scale_period : 0;
+		if (done > 0)
+			wait = (uint32_t)((uint64_t)backlog * scale_period / done);
+		// Пороги добавления и вывода разнесены, а вывод требует нескольких
+		// спокойных периодов подряд, чтобы пул не колебался
+		if (backlog > scale_up_backlog * count || wait > scale_up_wait)
+		{
+			calm_periods = 0;
+			if (count < max_alist_count && create_analyzer(FALSE) != NULL)
+				print_msglogf("Analyzer pool grown to %u (backlog %u, "
+					"wait %u ms).\n", count + 1, backlog, wait);
+		}
+		else if (backlog > scale_down_backlog * count)
+			calm_periods = 0;
+		else if (++calm_periods >= scale_down_periods)
+		{
+			calm_periods = 0;
+			if (count > min_alist_count)
+				retire_analyzer();
 		}
 	}
 }
@@ -10,10 +10,18 @@
 #define __ANALYZER_H__
 
 #include "algorithm.h"
+#include "conntrack.h"
+#include "dedup.h"
+#include "filter.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "reasm.h"
+#include "umem.h"
 
-#define PACKAGE_DATA_SIZE sizeof(void *) * 2  // Размер PackageData без буфера 
-#define PACKAGE_BUFFER_SIZE            65535  // Размер буфера пакета
+#define PACKAGE_BUFFER_SIZE      65535  // Размер пакета максимального размера
+#define MAX_QUEUE_SIZE      0x80000000  // Наибольшая очередь анализатора
 #define PARAM_NBSTATISTICS_COUNT 12 // Количество параметров статистики
+#define STREAM_LOCK_COUNT        64 // Частей таблицы концов потоков
 // Флаги TCP
 #define NUL_FTCP 0x00  // Нет флагов
 #define FIN_FTCP 0x01  // Завершение соединение
@@ -26,6 +34,43 @@
 #define WMODE_PASS 0x00  // Пассивный
 #define WMODE_STUD 0x01  // Обучение
 #define WMODE_MON  0x02  // Мониторинг
+// Распределение пакетов по анализаторам
+#define DMODE_FREE 0x00  // Первый анализатор со свободным местом
+#define DMODE_FLOW 0x01  // Анализатор, закрепленный за соединением
+// Действие, если у анализатора соединения нет места
+#define FFALLBACK_FREE 0x00  // Передать первому анализатору со свободным местом
+#define FFALLBACK_WAIT 0x01  // Ждать, пока анализатор освободит место
+// Состояние анализатора в пуле
+#define ASTATE_RUN   0x00  // Принимает пакеты
+#define ASTATE_DRAIN 0x01  // Дорабатывает очередь перед выводом из работы
+#define ASTATE_DONE  0x02  // Поток завершен, очередь еще не освобождена
+#define ASTATE_GRACE 0x03  // Очередь будет освобождена в следующем периоде
+#define ASTATE_FREE  0x04  // Очередь освобождена, анализатор можно запустить
+// Действие, если места нет ни у одного анализатора
+#define OPOLICY_DROP_NEWEST 0x00  // Отбросить новый пакет
+#define OPOLICY_DROP_OLDEST 0x01  // Отбросить самые старые пакеты очереди
+#define OPOLICY_BLOCK       0x02  // Ждать места ограниченное время
+// Класс обслуживания пакета
+#define PCLASS_PRIORITY 0x00  // SYN без данных, неразрешенный порт, ICMP
+#define PCLASS_BULK     0x01  // Остальные пакеты
+#define PCLASS_COUNT       2  // Количество классов
+// Этапы проверки после разбора заголовков анализатором
+#define STAGE_STATS 0x00  // Сбор статистики и отслеживание соединений
+#define STAGE_SCAN  0x01  // Проверка содержимого
+#define STAGE_LOG   0x02  // Вывод в файлы
+#define STAGE_COUNT    3  // Количество этапов
+
+// Профиль обслуживания порта
+#define PPROF_ALLOWED    0x01  // Порт разрешен
+#define PPROF_SCAN       0x02  // Проверять содержимое пакетов
+#define PPROF_LOG_SHIFT     2  // Смещение уровня вывода в лог
+#define PPROF_LOG_MASK   0x0C  // Уровень вывода в лог
+// Уровень вывода пакетов в лог
+#define PLOG_NONE   0x00  // Пакет не записывается
+#define PLOG_HEADER 0x01  // Записывается только заголовок
+#define PLOG_DATA   0x02  // Записываются заголовок и данные
+// Профиль порта по умолчанию
+#define PPROF_DEFAULT (PPROF_SCAN | PLOG_DATA << PPROF_LOG_SHIFT)
 
 // Заголовок IP-пакета
 typedef struct IPHeader
@@ -75,43 +120,165 @@ typedef struct ICMPHeader
 	uint16_t field2;   // type и code
 } ICMPHeader;
 
-// Список полуоткрытых соединений
-typedef struct SynTCPList
+// Конец одного направления TCP-потока для поиска шаблонов на стыке сегментов
+typedef struct StreamTail
 {
-	uint32_t  src;     // Адрес отправителя
-	uint16_t count;    // Количество для данного адреса
-	struct SynTCPList *next;  // Следующее соединение
-} SynTCPList;
+	uint32_t src;       // Адрес отправителя
+	uint32_t dst;       // Адрес получателя
+	uint16_t src_port;  // Порт отправителя
+	uint16_t dst_port;  // Порт получателя
+	uint32_t next_seq;  // Ожидаемый номер следующего сегмента
+	uint8_t len;        // Количество сохраненных байт
+	char data[];        // Последние pat_length-1 байт данных
+} StreamTail;
 
 // Данные для адаптера
 typedef struct AdapterData
 {
 	const char *addr;  // Сетевой адрес
 	FID fid;           // Идентификатор на файл
-	char buffer[PACKAGE_BUFFER_SIZE];  // Для хранения данных пакета
+	volatile LONG dropped;     // Отброшенные пакеты с прошлой записи в лог
+	volatile LONG lost;        // Отброшенные пакеты за все время работы
+	uint16_t weight;           // Вес адаптера при распределении места
+	volatile LONG queued[PCLASS_COUNT]; // Пакеты каждого класса в очередях
+	uint32_t group;            // Группа анализаторов рядом с приёмом
+	struct AdapterData *next;  // Следующий адаптер для учета отброшенных
 } AdapterData;
 
-// Тип данных для перемещения по буферу AnalyzerData
+// Пакеты, принятые адаптером за одно обращение
+typedef struct PackageBatch
+{
+	uint32_t count;        // Количество пакетов
+	const char **buffers;  // Содержимое пакетов
+	uint32_t *sizes;       // Количество принятых байт каждого пакета
+} PackageBatch;
+
+// Запись очереди анализатора о пакете
 typedef struct PackageData
 {
-	AdapterData *adapter;     // Ссылка на информацию об адаптере
-	struct PackageData *next; // Следующий адрес в буфере
-	IPHeader header;          // Заголовок пакета
+	AdapterData *adapter;     // Ссылка на адаптер (NULL - пакет проверен)
+	IPHeader *package;        // Пакет в слоте пула или в кадре UMEM
+	UmemFrame *frame;         // Кадр с пакетом (NULL - пакет в слоте)
+	uint32_t time;            // Время постановки в очередь (мс)
+	uint8_t pclass;           // Класс обслуживания пакета
 } PackageData;
 
+// Счетчики статистики одного анализатора (поля в порядке NBStats)
+typedef struct NBCounters
+{
+	uint32_t tcp_count;         // Общее количество пакетов TCP
+	uint32_t udp_count;         // Общее количество пакетов UDP
+	uint32_t icmp_count;        // Общее количество пакетов ICMP
+	uint32_t ip_count;          // Общее количество пакетов других протоколов
+	uint32_t syn_count;         // Кол-во полуоткрытых соединений TCP
+	uint32_t ask_sa_count;      // Кол-во открытых соединений TCP(ASK,SYN+ASK)
+	uint32_t fin_count;         // Кол-во закрытых соединений TCP
+	uint32_t rst_count;         // Кол-во сброшенных соединений TCP
+	uint32_t al_tcp_port_count; // Кол-во обращений к разрешенным портам TCP
+	uint32_t un_tcp_port_count; // Кол-во обращений к неразрешенным портам TCP
+	uint32_t al_udp_port_count; // Кол-во обращений к разрешенным портам UDP
+	uint32_t un_udp_port_count; // Кол-во обращений к неразрешенным портам UDP
+} NBCounters;
+
+// Счетчики ожидания пакетов каждого класса в очереди одного анализатора
+typedef struct ClassCounters
+{
+	uint32_t checked[PCLASS_COUNT];  // Количество проверенных пакетов
+	uint32_t wait[PCLASS_COUNT];     // Суммарное ожидание в очереди (мс)
+	volatile LONG max_wait[PCLASS_COUNT]; // Наибольшее ожидание с прошлой записи
+} ClassCounters;
+
+// Пакет пачки, которую анализатор проверяет по этапам
+typedef struct PackageEntry
+{
+	IPHeader *package;  // IP-заголовок
+	void *header;       // Заголовок TCP, UDP или ICMP (NULL - другой протокол)
+	uint8_t profile;    // Профиль обслуживания портов пакета
+	uint32_t flow;      // Соединение и направление (CONN_NONE - нет)
+} PackageEntry;
+
+// Описание пакета, передаваемое между этапами проверки. Запись пакета
+// остается в очереди анализатора, пока описание читает хотя бы один этап.
+typedef struct PackageDesc
+{
+	PackageData *pd;        // Запись пакета в очереди анализатора
+	struct AnalyzerData *owner; // Анализатор, в очереди которого пакет
+	volatile LONG refs;     // Количество этапов, еще читающих пакет
+	uint32_t route;         // Хэш соединения для выбора потока этапа
+	PackageEntry entry;     // Разобранные заголовки
+	PackageInfo info;       // Сведения для вывода в лог и оповещений
+} PackageDesc;
+
+// Рабочая область потока для проверки пачки пакетов
+typedef struct AnalyzerBatch
+{
+	PackageDesc **descs;    // Пакеты пачки
+	PackageDesc **scans;    // Пакеты для проверки содержимого
+	PackageDesc **writes;   // Пакеты для вывода в файлы
+	PackageLog *logs;       // Записи для вывода в файлы
+	NBCounters *counters;   // Счетчики статистики потока
+	ClassCounters *classes; // Счетчики ожидания классов потока
+} AnalyzerBatch;
+
+// Поток этапа проверки со своей очередью описаний пакетов
+typedef struct StageThread
+{
+	StageQueue queue;      // Очередь описаний
+	uint8_t stage;         // Этап
+	NBCounters counters;   // Счетчики статистики, собранной потоком
+	NBCounters merged;     // Счетчики на момент последнего сбора
+} StageThread;
+
 // Данные для анализатора
+// Очередь пакетов - кольцо записей одного размера с одним писателем
+// (производитель, занявший анализатор флагом lock); сами пакеты лежат в
+// слотах пулов. Пакеты из начала очереди забирает сам анализатор или, при
+// простое, другие анализаторы; запись освобождает производитель, когда
+// проверены все пакеты до неё. Поля производителя и потребителей лежат на
+// разных строках кэша. Счетчики статистики только растут и
+// изменяются одним потоком без блокировки; поток статистики прибавляет к
+// общей статистике их приращения с прошлого периода.
 typedef struct AnalyzerData
 {
 	uint16_t id;             // Идентификатор анализатора
-	PackageData *r_package;  // Указатель для чтения пакетов
-	PackageData *w_package;  // Указатель для записи пакетов
-	size_t pack_count;       // Количество непроверенных пакетов
-	Bool lock;               // Флаг, что анализатор занят другим потоком
-	Bool read;               // Флаг, что выполняется чтение
-	HANDLE mutex;            // Мьютекс для ожидания чтения при записи
-	char *buffer;            // Ссылка на буфер данных
+	volatile LONG lock;      // Флаг, что анализатор занят другим потоком
+	volatile LONG state;     // Состояние анализатора в пуле
+	HANDLE event;            // Событие о появлении новых пакетов
+	PackageData *entries;    // Записи очереди (количество - степень двойки)
+	struct AnalyzerData *next; // Следующий анализатор в списке
+	uint32_t group;          // Адаптер, рядом с приёмом которого работает поток
+	NBCounters merged;       // Счетчики на момент последнего сбора
+	ClassCounters merged_classes; // Счетчики классов на момент сбора
+	char pad_w[CACHE_LINE_SIZE];
+	uint32_t reclaimed;      // Количество пакетов, записи которых свободны
+	uint32_t written;        // Количество записанных пакетов
+	volatile LONG pushed;    // Количество пакетов, видимых анализаторам
+	volatile LONG dropped;   // Пакеты, отброшенные из очереди или для нее
+	char pad_r[CACHE_LINE_SIZE];
+	volatile LONG head;      // Количество взятых пакетов
+	volatile LONG finished;  // Количество проверенных пакетов
+	volatile LONG stolen;    // Пакеты, взятые у других анализаторов
+	volatile LONG parked;    // Флаг, что поток ждет события о новых пакетах
+	char pad_s[CACHE_LINE_SIZE];
+	NBCounters counters;     // Счетчики статистики пакетов, проверенных потоком
+	ClassCounters classes;   // Ожидание в очереди пакетов, проверенных потоком
+	char pad_end[CACHE_LINE_SIZE];
 } AnalyzerData;
 
+// Место в очереди анализатора для приёма пакетов в слоты пула без
+// копирования
+typedef struct PackageSlot
+{
+	AnalyzerData *analyzer;  // Анализатор, заблокированный для записи
+	uint32_t space;          // Сколько записей осталось в занятом месте
+	uint32_t count;          // Количество принятых, но не переданных пакетов
+	char *buffer;            // Промежуточный буфер (распределение по соединениям)
+	char *spare;             // Буфер для приёма пакетов, которым нет места
+	char *pool_slot;         // Слот пула для приёма следующего пакета
+	AdapterData *adapter;    // Адаптер, пакеты которого принимаются
+	uint8_t pclass;          // Класс пакетов, для которых занято место
+} PackageSlot;
+
 // Кольцевой список анализаторов
 typedef struct AnalyzerList
 {
@@ -127,11 +294,136 @@ typedef struct AnalyzerList
 */
 void run_analyzer(PList *tcp_ps, PList *udp_ps);
 
+/**
+@brief Добавляет адаптер в список для учета отброшенных пакетов
+@param data Данные об адаптере с заполненными addr и fid
+*/
+void register_adapter(AdapterData *data);
+
+/**
+@brief Проверяет, нужно ли передавать принятый пакет на анализ
+@param buffer Содержимое пакета
+@param count Количество принятых байт
+@return TRUE - пакет прошел фильтр и не является повтором
+*/
+Bool is_package_accepted(const char *buffer, size_t count);
+
+/**
+@brief Собирает фрагментированную датаграмму, передавая её на анализ
+@param data Данные об адаптере
+@param buffer Содержимое пакета
+@param count Количество принятых байт
+@return TRUE - пакет не фрагментирован и передается на анализ как есть
+*/
+Bool assemble_package(AdapterData *data, const char *buffer, size_t count);
+
+/**
+@brief Собирает фрагментированную датаграмму на месте принятого пакета
+@note Датаграмма, которая не помещается в слот, переносится в слот пула
+больших пакетов
+@param slot Занятое место с пакетом по адресу get_slot_buffer
+@param count Количество принятых байт
+@return Длина пакета для fill_slot (0 - пакет не передается на анализ)
+*/
+size_t assemble_slot(PackageSlot *slot, size_t count);
+
 /**
 @brief Добавляет пакет в очередь на анализ
-@param data Данные о пакете
+@param data Данные об адаптере
+@param buffer Содержимое пакета
+@param count Количество принятых байт
+*/
+void analyze_package(AdapterData *data, const char *buffer, size_t count);
+
+/**
+@brief Добавляет пакеты в очереди на анализ, занимая место сразу под все
+@param data Данные об адаптере
+@param batch Принятые пакеты
+*/
+void analyze_packages(AdapterData *data, const PackageBatch *batch);
+
+/**
+@brief Добавляет в очередь на анализ пакеты, оставляя их в кадрах UMEM
+@param data Данные об адаптере
+@param frames Кадры с принятыми пакетами
+@param sizes Количество принятых байт каждого пакета
+@param count Количество пакетов
+*/
+void analyze_frames(AdapterData *data, UmemFrame **frames,
+	const uint32_t *sizes, uint32_t count);
+
+/**
+@brief Подготавливает место для приёма пакетов потоком адаптера
+@note При распределении по соединениям анализатор неизвестен до приёма
+пакета, поэтому пакет принимается в промежуточный буфер
+@param slot Место для приёма
+@param data Данные об адаптере
+*/
+void init_slot(PackageSlot *slot, AdapterData *data);
+
+/**
+@brief Занимает место в очереди свободного анализатора
+@note Если места для всех пакетов нет, место занимается под один
+приоритетный пакет; если нет и его, принятые пакеты отбрасываются
+@param slot Для записи сведений о занятом месте
+@param count Сколько пакетов требуется принять
+*/
+void reserve_slot(PackageSlot *slot, uint32_t count);
+
+/**
+@brief Проверяет, осталось ли в занятом месте место под пакет
+@param slot Занятое место
+@return TRUE - можно принимать следующий пакет
+*/
+Bool is_slot_available(const PackageSlot *slot);
+
+/**
+@brief Возвращает адрес, по которому надо принять следующий пакет
+@param slot Занятое место
+@return Начало IP-заголовка следующего пакета
+*/
+char *get_slot_buffer(PackageSlot *slot);
+
+/**
+@brief Получает размер буфера по адресу get_slot_buffer
+@param slot Занятое место
+@return Сколько байт можно принять
+*/
+uint32_t get_slot_length(PackageSlot *slot);
+
+/**
+@brief Заменяет слот пула для приёма слотом большого пакета
+@note Если слотов больших пакетов нет, пакет учитывается как отброшенный
+@param slot Занятое место
+@return TRUE - следующий пакет принимается в слот большого пакета
+*/
+Bool grow_slot(PackageSlot *slot);
+
+/**
+@brief Учитывает пакет, не поместившийся в слот, как отброшенный
+@param slot Занятое место
+*/
+void drop_slot(PackageSlot *slot);
+
+/**
+@brief Фиксирует пакет, принятый по адресу get_slot_buffer
+@param slot Занятое место
+@param data Данные об адаптере
+@param count Количество принятых байт
+*/
+void fill_slot(PackageSlot *slot, AdapterData *data, size_t count);
+
+/**
+@brief Передает принятые пакеты анализатору и освобождает его
+@param slot Занятое место
+*/
+void publish_slot(PackageSlot *slot);
+
+/**
+@brief Проверяет, что анализаторы обработали все пакеты из очередей
+@return TRUE - очереди всех анализаторов пусты
 */
-void analyze_package(AdapterData *data);
+Bool is_analyzers_idle();
 
 /**
 @brief Получение имени протокола
@@ -0,0 +1,364 @@
+/******************************************************************************
+     * File: conntrack.c
+     * Description: Таблица TCP-соединений с удалением по таймеру.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "conntrack.h"
+
+#define TCP_FLAG_FIN 0x01 // Завершение соединения
+#define TCP_FLAG_SYN 0x02 // Запрос соединения
+#define TCP_FLAG_RST 0x04 // Сброс соединения
+#define TCP_FLAG_ACK 0x10 // Есть номер подтверждения
+
+ConnStripe *conn_stripes = NULL; // Части таблицы соединений
+uint32_t conn_stripe_mask;       // Маска номера записи в части
+uint32_t conn_stripe_size;       // Количество записей в части
+uint32_t wheel_tick;             // Длительность такта колеса (мс)
+uint32_t conn_syn_ticks;         // Время жизни открываемого соединения
+uint32_t conn_idle_ticks;        // Время жизни открытого соединения
+uint32_t conn_close_ticks;       // Время хранения закрытого соединения
+
+/**
+@brief Получает номер такта колеса по времени
+@param ms Время в мс
+@return Количество тактов (не меньше 1)
+*/
+uint32_t get_conn_ticks(uint32_t ms);
+
+/**
+@brief Получает время жизни соединения в состоянии
+@param state Состояние соединения
+@return Время жизни в тактах
+*/
+uint32_t get_state_ticks(uint8_t state);
+
+/**
+@brief Проворачивает колесо части до такта, удаляя устаревшие соединения
+@param st Часть таблицы
+@param tick Текущий такт
+*/
+void advance_conn_wheel(ConnStripe *st, uint32_t tick);
+
+/**
+@brief Ставит запись в ячейку колеса по времени её истечения
+@param st Часть таблицы
+@param index Номер записи в части
+*/
+void schedule_conn(ConnStripe *st, uint32_t index);
+
+/**
+@brief Убирает запись из ячейки колеса
+@param st Часть таблицы
+@param index Номер записи в части
+*/
+void unschedule_conn(ConnStripe *st, uint32_t index);
+
+/**
+@brief Изменяет состояние соединения по флагам сегмента
+@param ce Запись о соединении
+@param dir Направление сегмента (0 - от инициатора)
+@param flags Флаги TCP
+@return События соединения
+*/
+uint8_t update_conn_state(ConnEntry *ce, uint8_t dir, uint8_t flags);
+
+void init_conntrack(uint32_t table_size, uint32_t tick, uint32_t syn_timeout,
+	uint32_t idle_timeout, uint32_t close_timeout)
+{
+	wheel_tick = tick > 0 ? tick : 1;
+	conn_syn_ticks = get_conn_ticks(syn_timeout);
+	conn_idle_ticks = get_conn_ticks(idle_timeout);
+	conn_close_ticks = get_conn_ticks(close_timeout);
+	// Размер части - степень двойки, не меньше окна поиска; номер записи,
+	// умноженный на 2, с направлением должен быть меньше CONN_NONE
+	conn_stripe_size = CONN_PROBE_COUNT;
+	while ((uint64_t)conn_stripe_size * CONN_STRIPE_COUNT < table_size &&
+		conn_stripe_size < CONN_MAX_STRIPE)
+		conn_stripe_size <<= 1;
+	conn_stripe_mask = conn_stripe_size - 1;
+	conn_stripes = (ConnStripe *)calloc(CONN_STRIPE_COUNT, sizeof(ConnStripe));
+	uint32_t now = (uint32_t)(GetTickCount64() / wheel_tick);
+	for (int i = 0; i < CONN_STRIPE_COUNT; i++)
+	{
+		ConnStripe *st = &conn_stripes[i];
+		InitializeCriticalSection(&st->lock);
+		st->entries = (ConnEntry *)calloc(conn_stripe_size, sizeof(ConnEntry));
+		st->tick = now;
+		for (int j = 0; j < CONN_WHEEL_SIZE + CONN_OUTER_SIZE; j++)
+			st->wheel[j] = CONN_NONE;
+	}
+}
+
+uint32_t track_connection(uint32_t src, uint32_t dst, uint16_t src_port,
+	uint16_t dst_port, uint8_t flags, ConnStripe **locked, uint8_t *events)
+{
+	*events = CEVENT_NONE;
+	// Оба направления соединения попадают в одну запись
+	uint32_t a = src;
+	uint32_t b = dst;
+	uint32_t ports = (uint32_t)src_port << 16 | dst_port;
+	if (a > b || (a == b && src_port > dst_port))
+	{
+		a = dst;
+		b = src;
+		ports = (uint32_t)dst_port << 16 | src_port;
+	}
+	uint32_t hash = (a * 0x9E3779B1) ^ (b * 0x85EBCA6B) ^ (ports * 0xC2B2AE35);
+	hash ^= hash >> 16;
+	uint32_t stripe = hash & (CONN_STRIPE_COUNT - 1);
+	ConnStripe *st = &conn_stripes[stripe];
+	// Блокировка меняется, только когда сегмент попал в другую часть
+	if (*locked != st)
+	{
+		release_conn_stripe(*locked);
+		EnterCriticalSection(&st->lock);
+		*locked = st;
+		advance_conn_wheel(st, (uint32_t)(GetTickCount64() / wheel_tick));
+	}
+	uint32_t index = (hash >> 6) & conn_stripe_mask;
+	uint32_t found = CONN_NONE;
+	uint32_t free_index = CONN_NONE;
+	uint32_t old_index = CONN_NONE;
+	uint8_t dir = 0;
+	for (int i = 0; i < CONN_PROBE_COUNT && found == CONN_NONE; i++)
+	{
+		uint32_t j = (index + i) & conn_stripe_mask;
+		ConnEntry *ce = &st->entries[j];
+		if (ce->state == CSTATE_FREE)
+		{
+			if (free_index == CONN_NONE)
+				free_index = j;
+		}
+		else if (ce->src == src && ce->dst == dst &&
+			ce->src_port == src_port && ce->dst_port == dst_port)
+			found = j;
+		else if (ce->src == dst && ce->dst == src &&
+			ce->src_port == dst_port && ce->dst_port == src_port)
+		{
+			found = j;
+			dir = 1;
+		}
+		// При нехватке места вытесняется соединение, которое истечет раньше
+		else if (old_index == CONN_NONE ||
+			(int32_t)(ce->expire - st->entries[old_index].expire) < 0)
+			old_index = j;
+	}
+	flags &= TCP_FLAG_FIN | TCP_FLAG_SYN | TCP_FLAG_RST | TCP_FLAG_ACK;
+	if (found == CONN_NONE)
+	{
+		// Сброс неизвестного соединения учитывается, но не хранится
+		if (flags & TCP_FLAG_RST)
+		{
+			*events = CEVENT_RESET;
+			return CONN_NONE;
+		}
+		if (free_index != CONN_NONE)
+		{
+			found = free_index;
+			st->active++;
+		}
+		else
+		{
+			found = old_index;
+			unschedule_conn(st, found);
+		}
+		// Соединение, открытое до начала захвата, считается открытым
+		ConnEntry *ce = &st->entries[found];
+		ce->src = src;
+		ce->dst = dst;
+		ce->src_port = src_port;
+		ce->dst_port = dst_port;
+		ce->fin = 0;
+		if (flags == TCP_FLAG_SYN)
+		{
+			ce->state = CSTATE_SYN_SENT;
+			*events = CEVENT_OPENED;
+		}
+		else
+		{
+			ce->state = CSTATE_ESTABLISHED;
+			*events = update_conn_state(ce, 0, flags);
+		}
+		ce->expire = st->tick + get_state_ticks(ce->state);
+		schedule_conn(st, found);
+	}
+	else
+	{
+		ConnEntry *ce = &st->entries[found];
+		uint8_t state = ce->state;
+		*events = update_conn_state(ce, dir, flags);
+		ce->expire = st->tick + get_state_ticks(ce->state);
+		// Время соединения в том же состоянии только растет, поэтому
+		// запись переставляется, когда колесо дойдет до нее
+		if (ce->state != state)
+		{
+			unschedule_conn(st, found);
+			schedule_conn(st, found);
+		}
+	}
+	return (stripe * conn_stripe_size + found) << 1 | dir;
+}
+
+void release_conn_stripe(ConnStripe *locked)
+{
+	if (locked != NULL)
+		LeaveCriticalSection(&locked->lock);
+}
+
+void take_conn_stats(uint32_t *active, uint32_t *expired)
+{
+	*active = 0;
+	*expired = 0;
+	if (conn_stripes == NULL)
+		return;
+	uint32_t now = (uint32_t)(GetTickCount64() / wheel_tick);
+	for (int i = 0; i < CONN_STRIPE_COUNT; i++)
+	{
+		ConnStripe *st = &conn_stripes[i];
+		EnterCriticalSection(&st->lock);
+		advance_conn_wheel(st, now);
+		*active += st->active;
+		*expired += st->expired;
+		st->expired = 0;
+		LeaveCriticalSection(&st->lock);
+	}
+}
+
+uint32_t get_conn_ticks(uint32_t ms)
+{
+	uint32_t ticks = (ms + wheel_tick - 1) / wheel_tick;
+	return ticks > 0 ? ticks : 1;
+}
+
+uint32_t get_state_ticks(uint8_t state)
+{
+	if (state == CSTATE_SYN_SENT || state == CSTATE_SYN_RECV)
+		return conn_syn_ticks;
+	if (state == CSTATE_CLOSED)
+		return conn_close_ticks;
+	return conn_idle_ticks;
+}
+
+void advance_conn_wheel(ConnStripe *st, uint32_t tick)
+{
+	while ((int32_t)(tick - st->tick) > 0)
+	{
+		st->tick++;
+		uint32_t slot = st->tick & (CONN_WHEEL_SIZE - 1);
+		// Ближний уровень пройден, соединения следующей ячейки дальнего
+		// уровня распределяются по ближнему
+		if (slot == 0)
+		{
+			uint32_t *outer = &st->wheel[CONN_WHEEL_SIZE +
+				((st->tick / CONN_WHEEL_SIZE) & (CONN_OUTER_SIZE - 1))];
+			uint32_t index = *outer;
+			*outer = CONN_NONE;
+			while (index != CONN_NONE)
+			{
+				uint32_t next = st->entries[index].next;
+				schedule_conn(st, index);
+				index = next;
+			}
+		}
+		uint32_t index = st->wheel[slot];
+		st->wheel[slot] = CONN_NONE;
+		while (index != CONN_NONE)
+		{
+			ConnEntry *ce = &st->entries[index];
+			uint32_t next = ce->next;
+			// Соединение с продленным временем ставится в новую ячейку
+			if ((int32_t)(ce->expire - st->tick) > 0)
+				schedule_conn(st, index);
+			else
+			{
+				ce->state = CSTATE_FREE;
+				st->active--;
+				st->expired++;
+			}
+			index = next;
+		}
+	}
+}
+
+void schedule_conn(ConnStripe *st, uint32_t index)
+{
+	ConnEntry *ce = &st->entries[index];
+	uint32_t delta = ce->expire - st->tick;
+	if (delta < CONN_WHEEL_SIZE)
+		ce->slot = ce->expire & (CONN_WHEEL_SIZE - 1);
+	else
+	{
+		// Дальше дальнего уровня - в последнюю его ячейку, откуда запись
+		// будет переставлена заново
+		if (delta >= CONN_WHEEL_SIZE * CONN_OUTER_SIZE)
+			delta = CONN_WHEEL_SIZE * (CONN_OUTER_SIZE - 1);
+		ce->slot = CONN_WHEEL_SIZE + (((st->tick + delta) / CONN_WHEEL_SIZE) &
+			(CONN_OUTER_SIZE - 1));
+	}
+	ce->prev = CONN_NONE;
+	ce->next = st->wheel[ce->slot];
+	if (ce->next != CONN_NONE)
+		st->entries[ce->next].prev = index;
+	st->wheel[ce->slot] = index;
+}
+
+void unschedule_conn(ConnStripe *st, uint32_t index)
+{
+	ConnEntry *ce = &st->entries[index];
+	if (ce->prev != CONN_NONE)
+		st->entries[ce->prev].next = ce->next;
+	else
+		st->wheel[ce->slot] = ce->next;
+	if (ce->next != CONN_NONE)
+		st->entries[ce->next].prev = ce->prev;
+}
+
+uint8_t update_conn_state(ConnEntry *ce, uint8_t dir, uint8_t flags)
+{
+	if (flags & TCP_FLAG_RST)
+	{
+		if (ce->state == CSTATE_CLOSED)
+			return CEVENT_NONE;
+		ce->state = CSTATE_CLOSED;
+		return CEVENT_RESET;
+	}
+	// Новый SYN инициатора начинает открытие заново: порты заняты новым
+	// соединением или сегменты открытия проверены не по порядку
+	if (dir == 0 && flags == TCP_FLAG_SYN && ce->state != CSTATE_SYN_SENT &&
+		ce->state != CSTATE_SYN_RECV)
+	{
+		ce->state = CSTATE_SYN_SENT;
+		ce->fin = 0;
+		return CEVENT_OPENED;
+	}
+	switch (ce->state)
+	{
+		case CSTATE_SYN_SENT:
+			if (dir == 1 && flags == (TCP_FLAG_SYN | TCP_FLAG_ACK))
+			{
+				ce->state = CSTATE_SYN_RECV;
+				return CEVENT_NONE;
+			}
+			// Ответ ответчика мог быть не принят
+		case CSTATE_SYN_RECV:
+			if (dir == 0 && flags == TCP_FLAG_ACK)
+			{
+				ce->state = CSTATE_ESTABLISHED;
+				return CEVENT_ESTABLISHED;
+			}
+			break;
+		case CSTATE_CLOSED:
+			return CEVENT_NONE;
+	}
+	if (flags & TCP_FLAG_FIN)
+	{
+		uint8_t events = ce->fin == 0 ? CEVENT_CLOSED : CEVENT_NONE;
+		ce->fin |= 1 << dir;
+		ce->state = ce->fin == 3 ? CSTATE_CLOSED : CSTATE_CLOSING;
+		return events;
+	}
+	return CEVENT_NONE;
+}
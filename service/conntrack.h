@@ -0,0 +1,102 @@
+/******************************************************************************
+     * File: conntrack.h
+     * Description: Таблица TCP-соединений с удалением по таймеру.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __CONNTRACK_H__
+#define __CONNTRACK_H__
+
+#include "settings.h"
+
+#define CONN_NONE          0xFFFFFFFF // Нет записи (конец списка)
+#define CONN_STRIPE_COUNT  64   // Частей таблицы со своей блокировкой
+#define CONN_PROBE_COUNT   8    // Ячеек, просматриваемых при поиске записи
+#define CONN_MAX_STRIPE    0x01000000 // Наибольший размер части таблицы
+#define CONN_WHEEL_SIZE    256  // Ячеек ближнего уровня колеса (по такту)
+#define CONN_OUTER_SIZE    64   // Ячеек дальнего уровня (по CONN_WHEEL_SIZE)
+// Состояния соединения
+#define CSTATE_FREE        0x00 // Запись свободна
+#define CSTATE_SYN_SENT    0x01 // Принят SYN инициатора
+#define CSTATE_SYN_RECV    0x02 // Принят SYN+ACK ответчика
+#define CSTATE_ESTABLISHED 0x03 // Соединение открыто
+#define CSTATE_CLOSING     0x04 // FIN передан не всеми сторонами
+#define CSTATE_CLOSED      0x05 // Соединение закрыто или сброшено
+// События соединения для статистики
+#define CEVENT_NONE        0x00 // Событий нет
+#define CEVENT_OPENED      0x01 // Начато открытие соединения
+#define CEVENT_ESTABLISHED 0x02 // Открытие соединения завершено
+#define CEVENT_CLOSED      0x04 // Начато закрытие соединения
+#define CEVENT_RESET       0x08 // Соединение сброшено
+
+// Запись о соединении в части таблицы с открытой адресацией
+typedef struct ConnEntry
+{
+	uint32_t src;       // Адрес инициатора
+	uint32_t dst;       // Адрес ответчика
+	uint16_t src_port;  // Порт инициатора
+	uint16_t dst_port;  // Порт ответчика
+	uint32_t expire;    // Такт, на котором истекает время соединения
+	uint32_t prev;      // Предыдущая запись ячейки колеса
+	uint32_t next;      // Следующая запись ячейки колеса
+	uint16_t slot;      // Ячейка колеса (дальний уровень - после ближнего)
+	uint8_t state;      // Состояние соединения
+	uint8_t fin;        // Направления, передавшие FIN (бит 0 - инициатор)
+} ConnEntry;
+
+// Часть таблицы соединений со своей блокировкой и колесом таймеров
+typedef struct ConnStripe
+{
+	CRITICAL_SECTION lock; // Блокировка для работы с частью
+	ConnEntry *entries;   // Записи части
+	uint32_t tick;        // Последний обработанный такт колеса
+	uint32_t active;      // Количество занятых записей
+	uint32_t expired;     // Записи, удаленные по времени с прошлого сбора
+	uint32_t wheel[CONN_WHEEL_SIZE + CONN_OUTER_SIZE]; // Ячейки колеса
+} ConnStripe;
+
+/**
+@brief Создает таблицу соединений
+@param table_size Количество записей (округляется до степени двойки)
+@param tick Длительность такта колеса таймеров (мс)
+@param syn_timeout Время жизни не открытого до конца соединения (мс)
+@param idle_timeout Время жизни открытого соединения без пакетов (мс)
+@param close_timeout Время хранения закрытого соединения (мс)
+*/
+void init_conntrack(uint32_t table_size, uint32_t tick, uint32_t syn_timeout,
+	uint32_t idle_timeout, uint32_t close_timeout);
+
+/**
+@brief Переводит соединение сегмента в следующее состояние
+@note Часть таблицы остается занятой, пока следующий сегмент попадает в нее
+же; по окончании пачки её освобождает release_conn_stripe
+@param src Адрес отправителя
+@param dst Адрес получателя
+@param src_port Порт отправителя
+@param dst_port Порт получателя
+@param flags Флаги TCP
+@param locked Занятая часть таблицы (NULL - нет)
+@param events Для записи событий соединения
+@return Номер соединения, умноженный на 2, плюс направление сегмента
+(CONN_NONE - соединение не отслеживается)
+*/
+uint32_t track_connection(uint32_t src, uint32_t dst, uint16_t src_port,
+	uint16_t dst_port, uint8_t flags, ConnStripe **locked, uint8_t *events);
+
+/**
+@brief Освобождает часть таблицы, занятую track_connection
+@param locked Занятая часть таблицы (NULL - нет)
+*/
+void release_conn_stripe(ConnStripe *locked);
+
+/**
+@brief Удаляет устаревшие соединения и получает итоги таблицы
+@param active Для записи количества отслеживаемых соединений
+@param expired Для записи количества соединений, удаленных по времени
+с прошлого вызова
+*/
+void take_conn_stats(uint32_t *active, uint32_t *expired);
+
+#endif
@@ -0,0 +1,115 @@
+/******************************************************************************
+     * File: dedup.c
+     * Description: Подавление повторов пакета, принятых разными адаптерами.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "dedup.h"
+
+volatile LONG64 *dedup_table = NULL; // Метка (старшие 32 бита) и время приёма
+uint32_t dedup_mask = 0;             // Маска номера записи
+uint32_t dup_window = 0;           // Окно поиска повторов (0 - отключено)
+uint16_t dup_bytes = 0;            // Байт данных пакета в ключе
+volatile LONG dedup_hits = 0;        // Количество подавленных повторов
+
+/**
+@brief Добавляет 64-битное значение в хеш
+@param hash Текущее значение хеша
+@param value Добавляемое значение
+@return Новое значение хеша
+*/
+uint64_t mix_hash(uint64_t hash, uint64_t value);
+
+/**
+@brief Вычисляет хеш неизменяемых полей IP-заголовка и начала данных
+@param buffer Содержимое пакета
+@param count Количество принятых байт
+@return Хеш пакета
+*/
+uint64_t get_package_hash(const char *buffer, size_t count);
+
+void init_dedup(uint32_t table_size, uint32_t window, uint16_t bytes)
+{
+	if (window == 0)
+		return;
+	uint32_t size = DEDUP_MIN_TABLE_SIZE;
+	while (size < table_size && size < 0x80000000)
+		size <<= 1;
+	dedup_table = (volatile LONG64 *)calloc(size, sizeof(LONG64));
+	dedup_mask = size - 1;
+	dup_window = window;
+	dup_bytes = bytes;
+}
+
+Bool is_package_duplicate(const char *buffer, size_t count)
+{
+	if (dup_window == 0)
+		return FALSE;
+	uint64_t hash = get_package_hash(buffer, count);
+	// Метка не бывает нулевой, чтобы пустая запись ни с чем не совпала
+	uint32_t tag = (uint32_t)(hash >> 32) | 1;
+	uint32_t now = GetTickCount();
+	LONG64 value = (LONG64)(((uint64_t)tag << 32) | now);
+	volatile LONG64 *entry = &dedup_table[hash & dedup_mask];
+	LONG64 old = *entry;
+	// Запись заменяется без блокировок; если другой поток успел раньше,
+	// её содержимое проверяется ещё раз
+	for (int i = 0; i < 2; i++)
+	{
+		if ((uint32_t)((uint64_t)old >> 32) == tag &&
+			now - (uint32_t)old <= dup_window)
+		{
+			InterlockedIncrement(&dedup_hits);
+			return TRUE;
+		}
+		LONG64 seen = InterlockedCompareExchange64(entry, value, old);
+		if (seen == old)
+			break;
+		old = seen;
+	}
+	return FALSE;
+}
+
+uint32_t take_dedup_hits()
+{
+	return (uint32_t)InterlockedExchange(&dedup_hits, 0);
+}
+
+uint64_t mix_hash(uint64_t hash, uint64_t value)
+{
+	hash ^= value * 0x9E3779B97F4A7C15ULL;
+	hash = (hash ^ (hash >> 29)) * 0xBF58476D1CE4E5B9ULL;
+	return hash ^ (hash >> 32);
+}
+
+uint64_t get_package_hash(const char *buffer, size_t count)
+{
+	const uint8_t *p = (const uint8_t *)buffer;
+	uint64_t word;
+	// Версия, длина, идентификатор, смещение (TTL и контрольная сумма
+	// различаются у копий, прошедших маршрутизатор)
+	memcpy(&word, p, sizeof(word));
+	uint64_t hash = mix_hash(0, word);
+	// Протокол и адреса
+	memcpy(&word, p + 12, sizeof(word));
+	hash = mix_hash(hash, word ^ p[9]);
+	// Начало данных пакета
+	size_t shift = (p[0] & 0x0F) << 2;
+	size_t end = shift + dup_bytes;
+	if (end > count)
+		end = count;
+	for (; shift + sizeof(word) <= end; shift += sizeof(word))
+	{
+		memcpy(&word, p + shift, sizeof(word));
+		hash = mix_hash(hash, word);
+	}
+	if (shift < end)
+	{
+		word = 0;
+		memcpy(&word, p + shift, end - shift);
+		hash = mix_hash(hash, word);
+	}
+	return hash;
+}
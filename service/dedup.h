@@ -0,0 +1,38 @@
+/******************************************************************************
+     * File: dedup.h
+     * Description: Подавление повторов пакета, принятых разными адаптерами.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __DEDUP_H__
+#define __DEDUP_H__
+
+#include "settings.h"
+
+#define DEDUP_MIN_TABLE_SIZE 1024 // Минимальный размер таблицы
+
+/**
+@brief Создает таблицу недавно принятых пакетов
+@param table_size Количество записей (округляется до степени двойки)
+@param window Время, в течение которого совпадающий пакет - повтор (мс)
+@param bytes Количество байт данных пакета, входящих в ключ
+*/
+void init_dedup(uint32_t table_size, uint32_t window, uint16_t bytes);
+
+/**
+@brief Проверяет, был ли такой же пакет принят в пределах окна
+@param buffer Содержимое пакета, начиная с IP-заголовка
+@param count Количество принятых байт
+@return TRUE - пакет является повтором
+*/
+Bool is_package_duplicate(const char *buffer, size_t count);
+
+/**
+@brief Получает количество подавленных повторов и обнуляет его
+@return Количество повторов с прошлого вызова
+*/
+uint32_t take_dedup_hits();
+
+#endif
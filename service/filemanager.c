@@ -44,7 +44,20 @@ const char *stats_log_format = "\
 %s\n\
 tc=%u;\t\tuc=%u;\t\tic=%u;\t\tipc=%u;\n\
 sc=%u;\t\tac=%u;\t\tfc=%u;\t\trc=%u;\n\
-atc=%u;\t\tutc=%u;\t\tauc=%u;\t\tuuc=%u;\n\n";
+atc=%u;\t\tutc=%u;\t\tauc=%u;\t\tuuc=%u;\n\
+dup=%u;\n";
+// Шаблон для вывода очереди анализатора
+const char *analyzer_log_format = "\
+an%u: backlog=%u;\tstolen=%u;\tdropped=%u;\n";
+// Шаблон для вывода отброшенных пакетов адаптера
+const char *adapter_log_format = "\
+%s: dropped=%u;\n";
+// Шаблон для вывода очереди и ожидания класса обслуживания
+const char *class_log_format = "\
+%s: depth=%u;\twait=%u;\tmax_wait=%u;\n";
+// Шаблон для вывода таблицы соединений
+const char *conn_log_format = "\
+connections: active=%u;\texpired=%u;\n";
 // Шаблон для вывода сообщения об аномальном пакете
 const char *report_pa_format = "\
 \n!!!\n\
@@ -113,7 +126,10 @@ void run_filemanager()
 	// Создание потока
 	HANDLE hThread = CreateThread(NULL, 0, fm_thread, NULL, 0, NULL);
 	if (hThread != NULL)
+	{
 		print_msglog("File manager started!");
+		place_thread(hThread, TCLASS_HELPER, 0, "File manager");
+	}
 }
 
 FID add_log_file(const char *name)
@@ -166,6 +182,25 @@ void log_package(PackageInfo *info, const char *format, ...)
 	ReleaseMutex(pack_mutex);
 }
 
+void log_packages(const PackageLog *logs, uint32_t count)
+{
+	if (count == 0)
+		return;
+	WaitForSingleObject(pack_mutex, INFINITE);
+	FileList *flist = NULL;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		const PackageInfo *info = &logs[i].info;
+		// Пакеты пачки обычно приняты одним адаптером
+		if (flist == NULL || flist->id != info->fid)
+			flist = get_file(info->fid);
+		fputs(logs[i].header, flist->file);
+		fwrite(info->data, info->size - info->shift, 1, flist->file);
+		fputs("\"\n\n", flist->file);
+	}
+	ReleaseMutex(pack_mutex);
+}
+
 void log_stats(const char *format, ...)
 {
 	WaitForSingleObject(stats_mutex, INFINITE);
@@ -259,6 +294,14 @@ const char* get_format(Format format)
 			res = icmp_log_format; break;
 		case STATS:
 			res = stats_log_format; break;
+		case ANALYZER:
+			res = analyzer_log_format; break;
+		case ADAPTER:
+			res = adapter_log_format; break;
+		case CLASS:
+			res = class_log_format; break;
+		case CONN:
+			res = conn_log_format; break;
 		default:     
 			res = "Unknown format!";
 	}
@@ -13,6 +13,7 @@
 #include <time.h>
 
 #include "settings.h"
+#include "threads.h"
 
 #define FILE_NAME_SIZE 256
 #define FID uint8_t
@@ -20,7 +21,7 @@
 
 typedef enum Format 
 {
-	IP, TCP, UDP, ICMP, STATS
+	IP, TCP, UDP, ICMP, STATS, ANALYZER, ADAPTER, CLASS, CONN
 } Format;
 
 // Файл в который надо сохранить фрагменты
@@ -43,6 +44,13 @@ typedef struct PackageInfo
 	const char *data;   // Указатель на начало данных
 } PackageInfo;
 
+// Запись о пакете для вывода пачкой
+typedef struct PackageLog
+{
+	PackageInfo info;  // Информация о пакете
+	char header[160];  // Заголовок записи, сформированный по шаблону get_format
+} PackageLog;
+
 // Содержит информацию об аномальности пакета
 typedef struct PackAnomaly
 {
@@ -103,6 +111,13 @@ FID add_to_flist(FILE *file);
 */
 void log_package(PackageInfo *info, const char *format, ...);
 
+/**
+@brief Записывает в файлы информацию о пачке пакетов за одну блокировку
+@param logs Записи о пакетах
+@param count Количество записей
+*/
+void log_packages(const PackageLog *logs, uint32_t count);
+
 /**
 @brief Записывает статистику в файл
 @param format Форматированные данные
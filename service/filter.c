@@ -0,0 +1,392 @@
+/******************************************************************************
+     * File: filter.c
+     * Description: Фильтр пакетов в формате classic BPF.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "filter.h"
+#include "filemanager.h"
+
+#define FILTER_ACCEPT 0xFFFF // Результат программы для пропускаемого пакета
+#define FILTER_DROP   0x0000 // Результат программы для отбрасываемого пакета
+#define LABEL_NONE    0xFF   // Инструкция без отложенного перехода
+// Метки переходов программы
+#define LABEL_ACCEPT  0x00   // Пропустить пакет
+#define LABEL_DROP    0x01   // Отбросить пакет
+#define LABEL_HOSTS   0x02   // Узел пакета найден в списке
+#define LABEL_PROTO   0x03   // Протокол пакета найден в списке
+#define LABEL_TCP     0x04   // Проверка портов TCP
+#define LABEL_UDP     0x05   // Проверка портов UDP
+#define LABEL_COUNT   0x06
+// Смещения полей IP-заголовка
+#define IP_OFFSET_PROTOCOL 9
+#define IP_OFFSET_FLAGS    6
+#define IP_OFFSET_SRC      12
+#define IP_OFFSET_DST      16
+#define IP_FRAGMENT_MASK   0x1FFF
+
+// Состояние построения программы
+typedef struct FilterBuilder
+{
+	FilterInsn insns[FILTER_MAX_INSNS];  // Инструкции
+	uint8_t fixups[FILTER_MAX_INSNS];    // Метки отложенных переходов
+	int32_t labels[LABEL_COUNT];         // Положение меток
+	uint16_t len;                        // Количество инструкций
+	Bool overflow;                       // Программа не поместилась
+} FilterBuilder;
+
+FilterProgram *capture_filter = NULL; // Фильтр, применяемый при захвате
+
+/**
+@brief Добавляет инструкцию в программу
+@param fb Состояние построения
+@param code Код операции
+@param jt Смещение перехода, если условие выполнено
+@param jf Смещение перехода, если условие не выполнено
+@param k Операнд
+@param label Метка отложенного перехода или LABEL_NONE
+*/
+void emit_insn(FilterBuilder *fb, uint16_t code, uint8_t jt, uint8_t jf,
+	uint32_t k, uint8_t label);
+
+/**
+@brief Добавляет переход на метку, если A совпадает с одним из значений
+@param fb Состояние построения
+@param fl Список значений
+@param label Метка перехода
+*/
+void emit_matches(FilterBuilder *fb, const FilterList *fl, uint8_t label);
+
+/**
+@brief Добавляет проверку портов TCP или UDP
+@param fb Состояние построения
+@param ps Список разрешенных портов (в сетевом порядке)
+*/
+void emit_ports(FilterBuilder *fb, PList *ps);
+
+/**
+@brief Считывает из пакета число в сетевом порядке байт
+@param pkt Содержимое пакета
+@param len Длина пакета
+@param offset Смещение числа
+@param size Размер числа в байтах
+@param value Прочитанное значение
+@return FALSE - число выходит за пределы пакета
+*/
+Bool load_filter_value(const uint8_t *pkt, uint32_t len, uint32_t offset,
+	uint8_t size, uint32_t *value);
+
+void add_in_filter_list(FilterList *fl, uint32_t value)
+{
+	if (fl->count < FILTER_MAX_VALUES)
+		fl->values[fl->count++] = value;
+	else
+		print_errlogf("Too many filter values, %u is ignored\n", value);
+}
+
+FilterProgram *compile_filter(const FilterConfig *fc, PList *tcp_ps,
+	PList *udp_ps)
+{
+	Bool by_hosts = fc->include_hosts.count > 0 || fc->exclude_hosts.count > 0;
+	Bool by_protocols = fc->include_protocols.count > 0 ||
+		fc->exclude_protocols.count > 0;
+	if (!by_hosts && !by_protocols && !fc->filter_ports)
+		return NULL;
+	
+	FilterBuilder *fb = (FilterBuilder *)calloc(1, sizeof(FilterBuilder));
+	for (uint8_t i = 0; i < LABEL_COUNT; i++)
+		fb->labels[i] = -1;
+	
+	// Отбрасывание исключенных узлов (отправитель или получатель)
+	if (fc->exclude_hosts.count > 0)
+	{
+		emit_insn(fb, BPF_LD | BPF_W | BPF_ABS, 0, 0, IP_OFFSET_SRC, LABEL_NONE);
+		emit_matches(fb, &fc->exclude_hosts, LABEL_DROP);
+		emit_insn(fb, BPF_LD | BPF_W | BPF_ABS, 0, 0, IP_OFFSET_DST, LABEL_NONE);
+		emit_matches(fb, &fc->exclude_hosts, LABEL_DROP);
+	}
+	// Пропуск только указанных узлов
+	if (fc->include_hosts.count > 0)
+	{
+		emit_insn(fb, BPF_LD | BPF_W | BPF_ABS, 0, 0, IP_OFFSET_SRC, LABEL_NONE);
+		emit_matches(fb, &fc->include_hosts, LABEL_HOSTS);
+		emit_insn(fb, BPF_LD | BPF_W | BPF_ABS, 0, 0, IP_OFFSET_DST, LABEL_NONE);
+		emit_matches(fb, &fc->include_hosts, LABEL_HOSTS);
+		emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_DROP, LABEL_NONE);
+		fb->labels[LABEL_HOSTS] = fb->len;
+	}
+	// Отбор по протоколу
+	if (by_protocols)
+	{
+		emit_insn(fb, BPF_LD | BPF_B | BPF_ABS, 0, 0, IP_OFFSET_PROTOCOL,
+			LABEL_NONE);
+		emit_matches(fb, &fc->exclude_protocols, LABEL_DROP);
+		if (fc->include_protocols.count > 0)
+		{
+			emit_matches(fb, &fc->include_protocols, LABEL_PROTO);
+			emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_DROP, LABEL_NONE);
+			fb->labels[LABEL_PROTO] = fb->len;
+		}
+	}
+	// Отбор TCP и UDP по разрешенным портам
+	if (fc->filter_ports)
+	{
+		emit_insn(fb, BPF_LD | BPF_B | BPF_ABS, 0, 0, IP_OFFSET_PROTOCOL,
+			LABEL_NONE);
+		emit_insn(fb, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, IPPROTO_TCP, LABEL_NONE);
+		emit_insn(fb, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_TCP);
+		emit_insn(fb, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, IPPROTO_UDP, LABEL_NONE);
+		emit_insn(fb, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_UDP);
+		emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_ACCEPT, LABEL_NONE);
+		fb->labels[LABEL_TCP] = fb->len;
+		emit_ports(fb, tcp_ps);
+		fb->labels[LABEL_UDP] = fb->len;
+		emit_ports(fb, udp_ps);
+	}
+	fb->labels[LABEL_ACCEPT] = fb->len;
+	emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_ACCEPT, LABEL_NONE);
+	fb->labels[LABEL_DROP] = fb->len;
+	emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_DROP, LABEL_NONE);
+	
+	if (fb->overflow)
+	{
+		print_errlogf("Filter program exceeds %u instructions, "
+			"filter is disabled\n", FILTER_MAX_INSNS);
+		free(fb);
+		return NULL;
+	}
+	
+	// Разрешение отложенных переходов
+	for (uint16_t i = 0; i < fb->len; i++)
+		if (fb->fixups[i] != LABEL_NONE)
+			fb->insns[i].k = fb->labels[fb->fixups[i]] - (i + 1);
+	
+	FilterProgram *fp = (FilterProgram *)malloc(sizeof(FilterProgram));
+	fp->len = fb->len;
+	fp->insns = (FilterInsn *)malloc(fb->len * sizeof(FilterInsn));
+	memcpy(fp->insns, fb->insns, fb->len * sizeof(FilterInsn));
+	free(fb);
+	return fp;
+}
+
+void emit_insn(FilterBuilder *fb, uint16_t code, uint8_t jt, uint8_t jf,
+	uint32_t k, uint8_t label)
+{
+	if (fb->len >= FILTER_MAX_INSNS)
+	{
+		fb->overflow = TRUE;
+		return;
+	}
+	FilterInsn *insn = &fb->insns[fb->len];
+	insn->code = code;
+	insn->jt = jt;
+	insn->jf = jf;
+	insn->k = k;
+	fb->fixups[fb->len] = label;
+	fb->len++;
+}
+
+void emit_matches(FilterBuilder *fb, const FilterList *fl, uint8_t label)
+{
+	// Условные переходы BPF ограничены 255 инструкциями,
+	// поэтому к метке ведет безусловный переход
+	for (uint16_t i = 0; i < fl->count; i++)
+	{
+		emit_insn(fb, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, fl->values[i], LABEL_NONE);
+		emit_insn(fb, BPF_JMP | BPF_JA, 0, 0, 0, label);
+	}
+}
+
+void emit_ports(FilterBuilder *fb, PList *ps)
+{
+	FilterList fl;
+	fl.count = 0;
+	for (PNode *p = ps->beg; p != NULL; p = p->next)
+		add_in_filter_list(&fl, ntohs(p->value));
+	// Фрагменты без заголовка транспортного уровня пропускаются
+	emit_insn(fb, BPF_LD | BPF_H | BPF_ABS, 0, 0, IP_OFFSET_FLAGS, LABEL_NONE);
+	emit_insn(fb, BPF_JMP | BPF_JSET | BPF_K, 0, 1, IP_FRAGMENT_MASK,
+		LABEL_NONE);
+	emit_insn(fb, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_ACCEPT);
+	// X = длина IP-заголовка
+	emit_insn(fb, BPF_LDX | BPF_B | BPF_MSH, 0, 0, 0, LABEL_NONE);
+	// Порт получателя, затем порт отправителя (ответы сервера)
+	emit_insn(fb, BPF_LD | BPF_H | BPF_IND, 0, 0, 2, LABEL_NONE);
+	emit_matches(fb, &fl, LABEL_ACCEPT);
+	emit_insn(fb, BPF_LD | BPF_H | BPF_IND, 0, 0, 0, LABEL_NONE);
+	emit_matches(fb, &fl, LABEL_ACCEPT);
+	emit_insn(fb, BPF_RET | BPF_K, 0, 0, FILTER_DROP, LABEL_NONE);
+}
+
+Bool load_filter_value(const uint8_t *pkt, uint32_t len, uint32_t offset,
+	uint8_t size, uint32_t *value)
+{
+	if (offset > len || len - offset < size)
+		return FALSE;
+	*value = 0;
+	for (uint8_t i = 0; i < size; i++)
+		*value = (*value << 8) | pkt[offset + i];
+	return TRUE;
+}
+
+uint32_t run_filter(const FilterProgram *fp, const uint8_t *pkt, uint32_t len)
+{
+	uint32_t a = 0, x = 0;
+	for (uint32_t pc = 0; pc < fp->len; pc++)
+	{
+		const FilterInsn *insn = &fp->insns[pc];
+		uint32_t k = insn->k;
+		switch (insn->code)
+		{
+			case BPF_LD | BPF_W | BPF_ABS:
+				if (!load_filter_value(pkt, len, k, 4, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_H | BPF_ABS:
+				if (!load_filter_value(pkt, len, k, 2, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_B | BPF_ABS:
+				if (!load_filter_value(pkt, len, k, 1, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_W | BPF_IND:
+				if (!load_filter_value(pkt, len, x + k, 4, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_H | BPF_IND:
+				if (!load_filter_value(pkt, len, x + k, 2, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_B | BPF_IND:
+				if (!load_filter_value(pkt, len, x + k, 1, &a))
+					return FILTER_DROP;
+				break;
+			case BPF_LD | BPF_IMM:
+				a = k;
+				break;
+			case BPF_LDX | BPF_IMM:
+				x = k;
+				break;
+			case BPF_LDX | BPF_B | BPF_MSH:
+				if (k >= len)
+					return FILTER_DROP;
+				x = (pkt[k] & 0x0F) << 2;
+				break;
+			case BPF_JMP | BPF_JA:
+				pc += k;
+				break;
+			case BPF_JMP | BPF_JEQ | BPF_K:
+				pc += a == k ? insn->jt : insn->jf;
+				break;
+			case BPF_JMP | BPF_JGT | BPF_K:
+				pc += a > k ? insn->jt : insn->jf;
+				break;
+			case BPF_JMP | BPF_JGE | BPF_K:
+				pc += a >= k ? insn->jt : insn->jf;
+				break;
+			case BPF_JMP | BPF_JSET | BPF_K:
+				pc += a & k ? insn->jt : insn->jf;
+				break;
+			case BPF_RET | BPF_K:
+				return k;
+			case BPF_RET | BPF_A:
+				return a;
+			default:
+				return FILTER_DROP;
+		}
+	}
+	return FILTER_DROP;
+}
+
+void dump_filter(const FilterProgram *fp, uint8_t format)
+{
+	if (fp == NULL || format == FDUMP_NONE)
+		return;
+	print_msglogf("Capture filter: %u instructions\n", fp->len);
+	for (uint16_t i = 0; i < fp->len; i++)
+	{
+		const FilterInsn *insn = &fp->insns[i];
+		if (format == FDUMP_C)
+		{
+			print_msglogf("{ 0x%x, %u, %u, 0x%08x },\n",
+				insn->code, insn->jt, insn->jf, insn->k);
+			continue;
+		}
+		char op[SETTINGS_BUFFER_SIZE];
+		switch (insn->code)
+		{
+			case BPF_LD | BPF_W | BPF_ABS:
+				sprintf(op, "ld       [%u]", insn->k);
+				break;
+			case BPF_LD | BPF_H | BPF_ABS:
+				sprintf(op, "ldh      [%u]", insn->k);
+				break;
+			case BPF_LD | BPF_B | BPF_ABS:
+				sprintf(op, "ldb      [%u]", insn->k);
+				break;
+			case BPF_LD | BPF_W | BPF_IND:
+				sprintf(op, "ld       [x + %u]", insn->k);
+				break;
+			case BPF_LD | BPF_H | BPF_IND:
+				sprintf(op, "ldh      [x + %u]", insn->k);
+				break;
+			case BPF_LD | BPF_B | BPF_IND:
+				sprintf(op, "ldb      [x + %u]", insn->k);
+				break;
+			case BPF_LD | BPF_IMM:
+				sprintf(op, "ld       #0x%x", insn->k);
+				break;
+			case BPF_LDX | BPF_IMM:
+				sprintf(op, "ldx      #0x%x", insn->k);
+				break;
+			case BPF_LDX | BPF_B | BPF_MSH:
+				sprintf(op, "ldxb     4*([%u]&0xf)", insn->k);
+				break;
+			case BPF_JMP | BPF_JA:
+				sprintf(op, "ja       %u", i + 1 + insn->k);
+				break;
+			case BPF_JMP | BPF_JEQ | BPF_K:
+				sprintf(op, "jeq      #0x%-12x jt %u\tjf %u", insn->k,
+					i + 1 + insn->jt, i + 1 + insn->jf);
+				break;
+			case BPF_JMP | BPF_JGT | BPF_K:
+				sprintf(op, "jgt      #0x%-12x jt %u\tjf %u", insn->k,
+					i + 1 + insn->jt, i + 1 + insn->jf);
+				break;
+			case BPF_JMP | BPF_JGE | BPF_K:
+				sprintf(op, "jge      #0x%-12x jt %u\tjf %u", insn->k,
+					i + 1 + insn->jt, i + 1 + insn->jf);
+				break;
+			case BPF_JMP | BPF_JSET | BPF_K:
+				sprintf(op, "jset     #0x%-12x jt %u\tjf %u", insn->k,
+					i + 1 + insn->jt, i + 1 + insn->jf);
+				break;
+			case BPF_RET | BPF_K:
+				sprintf(op, "ret      #%u", insn->k);
+				break;
+			case BPF_RET | BPF_A:
+				sprintf(op, "ret      a");
+				break;
+			default:
+				sprintf(op, "unimp    0x%x", insn->code);
+				break;
+		}
+		print_msglogf("(%03u) %s\n", i, op);
+	}
+}
+
+void set_capture_filter(FilterProgram *fp)
+{
+	capture_filter = fp;
+}
+
+Bool is_package_passed(const char *buffer, size_t count)
+{
+	if (capture_filter == NULL)
+		return TRUE;
+	return run_filter(capture_filter, (const uint8_t *)buffer,
+		(uint32_t)count) != FILTER_DROP;
+}
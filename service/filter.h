@@ -0,0 +1,128 @@
+/******************************************************************************
+     * File: filter.h
+     * Description: Фильтр пакетов в формате classic BPF.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include <winsock2.h>
+
+#include "settings.h"
+
+#define FILTER_MAX_VALUES 64   // Максимальное количество значений в списке
+#define FILTER_MAX_INSNS  4096 // Максимальная длина программы
+// Классы инструкций BPF
+#define BPF_LD   0x00
+#define BPF_LDX  0x01
+#define BPF_JMP  0x05
+#define BPF_RET  0x06
+// Размер загружаемых данных
+#define BPF_W    0x00
+#define BPF_H    0x08
+#define BPF_B    0x10
+// Способ адресации
+#define BPF_IMM  0x00
+#define BPF_ABS  0x20
+#define BPF_IND  0x40
+#define BPF_MSH  0xA0
+// Операции перехода
+#define BPF_JA   0x00
+#define BPF_JEQ  0x10
+#define BPF_JGT  0x20
+#define BPF_JGE  0x30
+#define BPF_JSET 0x40
+// Источник операнда
+#define BPF_K    0x00
+#define BPF_X    0x08
+#define BPF_A    0x10
+// Формат вывода программы
+#define FDUMP_NONE 0x00  // Не выводить
+#define FDUMP_ASM  0x01  // Мнемоники (как tcpdump -d)
+#define FDUMP_C    0x02  // Массив для SO_ATTACH_FILTER (как tcpdump -dd)
+
+// Инструкция BPF (совпадает по размещению со struct sock_filter)
+typedef struct FilterInsn
+{
+	uint16_t code;  // Код операции
+	uint8_t  jt;    // Смещение перехода, если условие выполнено
+	uint8_t  jf;    // Смещение перехода, если условие не выполнено
+	uint32_t k;     // Операнд
+} FilterInsn;
+
+// Программа фильтра
+typedef struct FilterProgram
+{
+	uint16_t len;       // Количество инструкций
+	FilterInsn *insns;  // Инструкции
+} FilterProgram;
+
+// Список значений условия фильтра
+typedef struct FilterList
+{
+	uint16_t count;                   // Количество значений
+	uint32_t values[FILTER_MAX_VALUES]; // Значения в порядке узла
+} FilterList;
+
+// Условия, по которым строится фильтр
+typedef struct FilterConfig
+{
+	FilterList include_protocols; // Пропускать только эти протоколы
+	FilterList exclude_protocols; // Отбрасывать эти протоколы
+	FilterList include_hosts;     // Пропускать только пакеты этих узлов
+	FilterList exclude_hosts;     // Отбрасывать пакеты этих узлов
+	Bool filter_ports;            // Отбрасывать TCP/UDP к неразрешенным портам
+	uint8_t dump;                 // Формат вывода программы
+} FilterConfig;
+
+/**
+@brief Добавляет значение в список условия
+@param fl Список условия
+@param value Значение в порядке узла
+*/
+void add_in_filter_list(FilterList *fl, uint32_t value);
+
+/**
+@brief Строит программу фильтра по условиям
+@param fc Условия фильтра
+@param tcp_ps Список разрешенных TCP портов
+@param udp_ps Список разрешенных UDP портов
+@return Программа или NULL, если отбрасывать нечего
+*/
+FilterProgram *compile_filter(const FilterConfig *fc, PList *tcp_ps,
+	PList *udp_ps);
+
+/**
+@brief Выполняет программу над пакетом, начинающимся с IP-заголовка
+@param fp Программа фильтра
+@param pkt Содержимое пакета
+@param len Длина пакета
+@return Сколько байт пакета оставить (0 - отбросить)
+*/
+uint32_t run_filter(const FilterProgram *fp, const uint8_t *pkt, uint32_t len);
+
+/**
+@brief Выводит программу фильтра пользователю
+@param fp Программа фильтра
+@param format Формат вывода
+*/
+void dump_filter(const FilterProgram *fp, uint8_t format);
+
+/**
+@brief Устанавливает фильтр, применяемый к захваченным пакетам
+@param fp Программа фильтра (NULL - пропускать все)
+*/
+void set_capture_filter(FilterProgram *fp);
+
+/**
+@brief Проверяет пакет фильтром захвата
+@param buffer Содержимое пакета, начиная с IP-заголовка
+@param count Длина пакета
+@return TRUE - пакет передается на анализ
+*/
+Bool is_package_passed(const char *buffer, size_t count);
+
+#endif
@@ -10,6 +10,9 @@
 
 int main()
 {
+	// Размещение потоков по процессорам
+	init_threads();
+	
 	//Запуск файлового менеджера
 	run_filemanager();
 	
@@ -0,0 +1,131 @@
+/******************************************************************************
+     * File: pipeline.c
+     * Description: Ограниченные очереди между этапами проверки пакетов.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "pipeline.h"
+
+/**
+@brief Сдвигает позицию очереди с переполнением счетчика
+@param pos Позиция
+@param shift Сдвиг
+@return Новая позиция
+*/
+LONG shift_stage_pos(LONG pos, ULONG shift);
+
+void init_stage_queue(StageQueue *queue, uint32_t size)
+{
+	uint32_t count = 2;
+	while (count < size)
+		count <<= 1;
+	queue->cells = (StageCell *)malloc(count * sizeof(StageCell));
+	queue->mask = count - 1;
+	// Ячейка i готова к записи на позиции i
+	for (uint32_t i = 0; i < count; i++)
+		queue->cells[i].seq = i;
+	queue->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	queue->parked = FALSE;
+	queue->tail = 0;
+	queue->head = 0;
+}
+
+Bool try_push_stage(StageQueue *queue, void *item)
+{
+	LONG pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	StageCell *cell;
+	while (TRUE)
+	{
+		cell = &queue->cells[pos & queue->mask];
+		// Разность позиций верна и после переполнения счетчиков
+		LONG diff = shift_stage_pos(__atomic_load_n(&cell->seq,
+			__ATOMIC_ACQUIRE), -(ULONG)pos);
+		if (diff == 0)
+		{
+			LONG prev = InterlockedCompareExchange(&queue->tail,
+				shift_stage_pos(pos, 1), pos);
+			if (prev == pos)
+				break;
+			pos = prev;
+		}
+		// Ячейку с прошлого оборота еще не освободил читатель
+		else if (diff < 0)
+			return FALSE;
+		else
+			pos = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+	}
+	cell->item = item;
+	__atomic_store_n(&cell->seq, shift_stage_pos(pos, 1), __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+void push_stage(StageQueue *queue, void *item)
+{
+	// Очередь ограничена: этап ждет, пока следующий этап её разберет
+	while (!try_push_stage(queue, item))
+	{
+		wake_stage(queue);
+		Sleep(1);
+	}
+}
+
+uint32_t pop_stage(StageQueue *queue, void **items, uint32_t max)
+{
+	uint32_t count = 0;
+	LONG pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	while (count < max)
+	{
+		StageCell *cell = &queue->cells[pos & queue->mask];
+		LONG diff = shift_stage_pos(__atomic_load_n(&cell->seq,
+			__ATOMIC_ACQUIRE), -(ULONG)pos - 1);
+		if (diff == 0)
+		{
+			LONG prev = InterlockedCompareExchange(&queue->head,
+				shift_stage_pos(pos, 1), pos);
+			if (prev != pos)
+			{
+				pos = prev;
+				continue;
+			}
+			items[count++] = cell->item;
+			// Ячейка освобождается для записи на следующем обороте
+			__atomic_store_n(&cell->seq, shift_stage_pos(pos, queue->mask + 1),
+				__ATOMIC_RELEASE);
+			pos = shift_stage_pos(pos, 1);
+		}
+		// Очередь пуста
+		else if (diff < 0)
+			break;
+		else
+			pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	}
+	return count;
+}
+
+void wake_stage(StageQueue *queue)
+{
+	// Парный барьер к установке parked в park_stage: либо читатель увидит
+	// новые элементы, либо писатель увидит, что он уснул
+	MemoryBarrier();
+	if (queue->parked && InterlockedExchange(&queue->parked, FALSE))
+		SetEvent(queue->event);
+}
+
+void park_stage(StageQueue *queue)
+{
+	InterlockedExchange(&queue->parked, TRUE);
+	// Элемент мог появиться до отметки об ожидании
+	LONG pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+	StageCell *cell = &queue->cells[pos & queue->mask];
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) !=
+		shift_stage_pos(pos, 1))
+		WaitForSingleObject(queue->event, INFINITE);
+	InterlockedExchange(&queue->parked, FALSE);
+}
+
+LONG shift_stage_pos(LONG pos, ULONG shift)
+{
+	return (LONG)((ULONG)pos + shift);
+}
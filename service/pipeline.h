@@ -0,0 +1,84 @@
+/******************************************************************************
+     * File: pipeline.h
+     * Description: Ограниченные очереди между этапами проверки пакетов.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "settings.h"
+
+#define CACHE_LINE_SIZE 64  // Размер строки кэша процессора
+
+// Ячейка очереди: номер показывает, чей ход - писателя или читателя
+typedef struct StageCell
+{
+	volatile LONG seq;  // Позиция, для которой ячейка готова
+	void *item;         // Ссылка на элемент
+} StageCell;
+
+// Ограниченная очередь ссылок с многими писателями и читателями. Позиции
+// записи и чтения лежат на разных строках кэша; читатель, не нашедший
+// элементов, засыпает до сигнала писателя.
+typedef struct StageQueue
+{
+	StageCell *cells;       // Ячейки (количество - степень двойки)
+	uint32_t mask;          // Маска номера ячейки
+	HANDLE event;           // Событие о появлении элементов
+	volatile LONG parked;   // Флаг, что читатель ждет события
+	char pad_w[CACHE_LINE_SIZE];
+	volatile LONG tail;     // Позиция записи
+	char pad_r[CACHE_LINE_SIZE];
+	volatile LONG head;     // Позиция чтения
+	char pad_end[CACHE_LINE_SIZE];
+} StageQueue;
+
+/**
+@brief Создает пустую очередь
+@param queue Очередь
+@param size Количество ячеек (округляется до степени двойки)
+*/
+void init_stage_queue(StageQueue *queue, uint32_t size);
+
+/**
+@brief Добавляет элемент, если в очереди есть место
+@param queue Очередь
+@param item Элемент
+@return FALSE - очередь заполнена
+*/
+Bool try_push_stage(StageQueue *queue, void *item);
+
+/**
+@brief Добавляет элемент, ожидая места в заполненной очереди
+@note Читатель будится при ожидании; после серии элементов его будит
+wake_stage
+@param queue Очередь
+@param item Элемент
+*/
+void push_stage(StageQueue *queue, void *item);
+
+/**
+@brief Забирает элементы из начала очереди
+@param queue Очередь
+@param items Для записи элементов
+@param max Наибольшее количество элементов
+@return Количество забранных элементов
+*/
+uint32_t pop_stage(StageQueue *queue, void **items, uint32_t max);
+
+/**
+@brief Будит читателя, если он ждет события
+@param queue Очередь
+*/
+void wake_stage(StageQueue *queue);
+
+/**
+@brief Усыпляет читателя до появления элементов
+@param queue Очередь
+*/
+void park_stage(StageQueue *queue);
+
+#endif
@@ -0,0 +1,285 @@
+/******************************************************************************
+     * File: pool.c
+     * Description: Пулы слотов фиксированного размера для пакетов в очередях.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "pool.h"
+
+SlotPool pools[POOL_COUNT];           // Пулы слотов
+DWORD cache_tls = TLS_OUT_OF_INDEXES; // Индекс кэша в памяти потока
+
+/**
+@brief Создает пул, все слоты которого лежат на складе
+@param pool Пул
+@param slot_size Размер слота
+@param slot_count Начальное количество слотов
+@param slot_limit Наибольшее количество слотов
+*/
+void init_slot_pool(SlotPool *pool, uint32_t slot_size, uint32_t slot_count,
+	uint32_t slot_limit);
+
+/**
+@brief Выделяет память под слоты и кладет их на склад
+@param pool Пул
+@param count Количество добавляемых слотов
+@return TRUE - слоты добавлены
+*/
+Bool add_pool_slots(SlotPool *pool, uint32_t count);
+
+/**
+@brief Добавляет слоты в пул, склад которого опустел
+@param pool Пул
+@param seen Количество слотов пула, когда склад оказался пуст
+@return TRUE - в пуле появились новые слоты
+*/
+Bool grow_slot_pool(SlotPool *pool, uint32_t seen);
+
+/**
+@brief Берет магазин со слотами со склада, при необходимости расширяя пул
+@param pool Пул
+@return Магазин (NULL - пул достиг наибольшего размера и склад пуст)
+*/
+SlotMagazine *take_full_magazine(SlotPool *pool);
+
+/**
+@brief Получает кэш потока, создавая его при первом обращении
+@return Кэш потока
+*/
+SlotCache *get_slot_cache();
+
+/**
+@brief Получает номер пула, которому принадлежит слот
+@param slot Слот
+@return Номер пула
+*/
+int get_slot_pool(const char *slot);
+
+/**
+@brief Берет пустой магазин со склада или создает новый
+@param pool Пул
+@return Пустой магазин
+*/
+SlotMagazine *take_empty_magazine(SlotPool *pool);
+
+/**
+@brief Отдает пустой магазин на склад
+@param pool Пул
+@param mag Пустой магазин
+*/
+void put_empty_magazine(SlotPool *pool, SlotMagazine *mag);
+
+void init_slot_pools(uint32_t slot_size, uint32_t slot_count,
+	uint32_t slot_limit, uint32_t jumbo_count)
+{
+	cache_tls = TlsAlloc();
+	slot_size = (slot_size + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+	init_slot_pool(&pools[POOL_MTU], slot_size, slot_count, slot_limit);
+	init_slot_pool(&pools[POOL_JUMBO], JUMBO_SLOT_SIZE, jumbo_count,
+		jumbo_count);
+}
+
+void init_slot_pool(SlotPool *pool, uint32_t slot_size, uint32_t slot_count,
+	uint32_t slot_limit)
+{
+	if (slot_count > slot_limit)
+		slot_count = slot_limit;
+	pool->slot_size = slot_size;
+	pool->slot_count = 0;
+	pool->slot_limit = slot_limit;
+	pool->grow_count = slot_count > 0 ? slot_count : slot_limit;
+	// В малом пуле магазины меньше, чтобы слоты не оседали в кэшах потоков
+	pool->mag_size = slot_limit / 64;
+	if (pool->mag_size > SLOT_MAGAZINE_SIZE)
+		pool->mag_size = SLOT_MAGAZINE_SIZE;
+	if (pool->mag_size == 0)
+		pool->mag_size = 1;
+	InitializeCriticalSection(&pool->grow_lock);
+	// Слоты лежат в одной области, чтобы пул слота определялся по адресу;
+	// память выделяется только под добавленные слоты
+	pool->memory = (char *)VirtualAlloc(NULL, (size_t)slot_limit * slot_size,
+		MEM_RESERVE, PAGE_NOACCESS);
+	// В каждом магазине склада есть хотя бы один слот, поэтому склад
+	// не переполняется
+	init_stage_queue(&pool->full, slot_limit);
+	init_stage_queue(&pool->empty, slot_limit / pool->mag_size + 1);
+	add_pool_slots(pool, slot_count);
+}
+
+Bool add_pool_slots(SlotPool *pool, uint32_t count)
+{
+	uint32_t first = pool->slot_count;
+	if (count == 0 || VirtualAlloc(pool->memory + (size_t)first *
+		pool->slot_size, (size_t)count * pool->slot_size, MEM_COMMIT,
+		PAGE_READWRITE) == NULL)
+		return FALSE;
+	// Добавленные слоты свободны
+	for (uint32_t i = first; i < first + count; i += pool->mag_size)
+	{
+		SlotMagazine *mag = (SlotMagazine *)malloc(sizeof(SlotMagazine));
+		mag->count = 0;
+		for (uint32_t j = i; j < first + count && j < i + pool->mag_size; j++)
+			mag->slots[mag->count++] = pool->memory +
+				(size_t)j * pool->slot_size;
+		push_stage(&pool->full, mag);
+	}
+	__atomic_store_n(&pool->slot_count, first + count, __ATOMIC_RELEASE);
+	return TRUE;
+}
+
+Bool grow_slot_pool(SlotPool *pool, uint32_t seen)
+{
+	if (seen >= pool->slot_limit)
+		return FALSE;
+	EnterCriticalSection(&pool->grow_lock);
+	// Пока поток ждал блокировку, пул мог расширить другой поток
+	Bool grown = pool->slot_count != seen;
+	if (!grown)
+	{
+		uint32_t count = pool->slot_limit - seen;
+		if (count > pool->grow_count)
+			count = pool->grow_count;
+		grown = add_pool_slots(pool, count);
+	}
+	LeaveCriticalSection(&pool->grow_lock);
+	return grown;
+}
+
+SlotMagazine *take_full_magazine(SlotPool *pool)
+{
+	SlotMagazine *mag;
+	uint32_t seen = __atomic_load_n(&pool->slot_count, __ATOMIC_ACQUIRE);
+	while (pop_stage(&pool->full, (void **)&mag, 1) == 0)
+	{
+		if (!grow_slot_pool(pool, seen))
+			return NULL;
+		seen = __atomic_load_n(&pool->slot_count, __ATOMIC_ACQUIRE);
+	}
+	return mag;
+}
+
+char *alloc_slot(size_t size)
+{
+	SlotCache *cache = get_slot_cache();
+	// Если слотов обычного размера нет, пакет занимает слот большого пакета
+	for (int i = POOL_MTU; i < POOL_COUNT; i++)
+	{
+		if (size > pools[i].slot_size)
+			continue;
+		SlotMagazine *loaded = cache->loaded[i];
+		if (loaded->count == 0)
+		{
+			SlotMagazine *full;
+			// Предыдущий магазин либо полон, либо пуст
+			if (cache->previous[i]->count > 0)
+			{
+				cache->loaded[i] = cache->previous[i];
+				cache->previous[i] = loaded;
+			}
+			else if ((full = take_full_magazine(&pools[i])) != NULL)
+			{
+				put_empty_magazine(&pools[i], cache->previous[i]);
+				cache->previous[i] = loaded;
+				cache->loaded[i] = full;
+			}
+			else
+				continue;
+			loaded = cache->loaded[i];
+		}
+		return loaded->slots[--loaded->count];
+	}
+	return NULL;
+}
+
+void free_slot(char *slot)
+{
+	SlotCache *cache = get_slot_cache();
+	int i = get_slot_pool(slot);
+	SlotMagazine *loaded = cache->loaded[i];
+	if (loaded->count == pools[i].mag_size)
+	{
+		if (cache->previous[i]->count == 0)
+		{
+			cache->loaded[i] = cache->previous[i];
+			cache->previous[i] = loaded;
+		}
+		else
+		{
+			// Полный предыдущий магазин уходит на склад
+			push_stage(&pools[i].full, cache->previous[i]);
+			cache->previous[i] = loaded;
+			cache->loaded[i] = take_empty_magazine(&pools[i]);
+		}
+		loaded = cache->loaded[i];
+	}
+	loaded->slots[loaded->count++] = slot;
+}
+
+uint32_t get_slot_size(const char *slot)
+{
+	return pools[get_slot_pool(slot)].slot_size;
+}
+
+void flush_slot_cache()
+{
+	SlotCache *cache = (SlotCache *)TlsGetValue(cache_tls);
+	if (cache == NULL)
+		return;
+	for (int i = 0; i < POOL_COUNT; i++)
+	{
+		SlotMagazine *mags[2] = { cache->loaded[i], cache->previous[i] };
+		for (int j = 0; j < 2; j++)
+			// Неполный магазин тоже уходит на склад полных
+			if (mags[j]->count > 0)
+				push_stage(&pools[i].full, mags[j]);
+			else
+				put_empty_magazine(&pools[i], mags[j]);
+	}
+	free(cache);
+	TlsSetValue(cache_tls, NULL);
+}
+
+SlotCache *get_slot_cache()
+{
+	SlotCache *cache = (SlotCache *)TlsGetValue(cache_tls);
+	if (cache == NULL)
+	{
+		cache = (SlotCache *)malloc(sizeof(SlotCache));
+		for (int i = 0; i < POOL_COUNT; i++)
+		{
+			cache->loaded[i] = take_empty_magazine(&pools[i]);
+			cache->previous[i] = take_empty_magazine(&pools[i]);
+		}
+		TlsSetValue(cache_tls, cache);
+	}
+	return cache;
+}
+
+int get_slot_pool(const char *slot)
+{
+	SlotPool *pool = &pools[POOL_MTU];
+	if (slot >= pool->memory &&
+		slot < pool->memory + (size_t)pool->slot_limit * pool->slot_size)
+		return POOL_MTU;
+	return POOL_JUMBO;
+}
+
+SlotMagazine *take_empty_magazine(SlotPool *pool)
+{
+	SlotMagazine *mag;
+	if (pop_stage(&pool->empty, (void **)&mag, 1) == 0)
+	{
+		mag = (SlotMagazine *)malloc(sizeof(SlotMagazine));
+		mag->count = 0;
+	}
+	return mag;
+}
+
+void put_empty_magazine(SlotPool *pool, SlotMagazine *mag)
+{
+	// Лишние пустые магазины не хранятся
+	if (!try_push_stage(&pool->empty, mag))
+		free(mag);
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+     * File: pool.h
+     * Description: Пулы слотов фиксированного размера для пакетов в очередях.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include "pipeline.h"
+
+#define POOL_MTU            0  // Слоты под пакеты обычного размера
+#define POOL_JUMBO          1  // Слоты под пакеты максимального размера
+#define POOL_COUNT          2  // Количество пулов
+#define JUMBO_SLOT_SIZE 65536  // Размер слота пула больших пакетов
+#define SLOT_MAGAZINE_SIZE 32  // Наибольшее число слотов в магазине
+
+// Магазин - набор свободных слотов, которым поток и общий склад
+// обмениваются целиком
+typedef struct SlotMagazine
+{
+	uint32_t count;                    // Количество слотов
+	char *slots[SLOT_MAGAZINE_SIZE];   // Свободные слоты
+} SlotMagazine;
+
+// Пул слотов одного размера в общей области памяти; область резервируется
+// под наибольшее количество слотов, а память выделяется по мере нехватки
+typedef struct SlotPool
+{
+	char *memory;         // Область всех слотов
+	uint32_t slot_size;   // Размер слота в байтах
+	volatile uint32_t slot_count; // Количество слотов с выделенной памятью
+	uint32_t slot_limit;  // Наибольшее количество слотов
+	uint32_t grow_count;  // Слотов, добавляемых за раз
+	uint32_t mag_size;    // Слотов в магазине пула
+	CRITICAL_SECTION grow_lock; // Блокировка для добавления слотов
+	StageQueue full;      // Склад магазинов со слотами
+	StageQueue empty;     // Склад пустых магазинов
+} SlotPool;
+
+// Кэш потока: слоты берутся и возвращаются без обращения к складу, пока
+// не опустеют или не заполнятся оба магазина пула
+typedef struct SlotCache
+{
+	SlotMagazine *loaded[POOL_COUNT];   // Магазин, с которым идет работа
+	SlotMagazine *previous[POOL_COUNT]; // Предыдущий магазин
+} SlotCache;
+
+/**
+@brief Создает пулы слотов
+@param slot_size Размер слота пакетов обычного размера (округляется до
+строки кэша)
+@param slot_count Начальное количество слотов пакетов обычного размера
+(и количество, на которое пул растет, когда свободных слотов нет)
+@param slot_limit Наибольшее количество слотов пакетов обычного размера
+@param jumbo_count Количество слотов пакетов максимального размера
+*/
+void init_slot_pools(uint32_t slot_size, uint32_t slot_count,
+	uint32_t slot_limit, uint32_t jumbo_count);
+
+/**
+@brief Берет слот, в который помещается пакет
+@note Если слотов обычного размера нет, берется слот большого пакета
+@param size Размер пакета
+@return Слот (NULL - свободных слотов нет)
+*/
+char *alloc_slot(size_t size);
+
+/**
+@brief Возвращает слот в кэш потока
+@param slot Слот, полученный alloc_slot
+*/
+void free_slot(char *slot);
+
+/**
+@brief Получает размер слота
+@param slot Слот, полученный alloc_slot
+@return Размер в байтах
+*/
+uint32_t get_slot_size(const char *slot);
+
+/**
+@brief Возвращает магазины кэша потока на склад перед завершением потока
+*/
+void flush_slot_cache();
+
+#endif
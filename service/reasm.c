@@ -0,0 +1,185 @@
+/******************************************************************************
+     * File: reasm.c
+     * Description: Сборка фрагментированных IPv4-пакетов в ограниченной памяти.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "reasm.h"
+
+#define IP_FLAG_MF       0x2000 // Есть ещё фрагменты
+#define IP_FRAGMENT_MASK 0x1FFF // Смещение фрагмента в 8-байтовых блоках
+
+ReasmBuffer *reasm_buffers = NULL; // Буферы сборки
+uint32_t reasm_count = 0;          // Количество буферов
+uint32_t frag_timeout = 0;        // Время ожидания фрагментов (мс)
+uint16_t frag_per_source = 0;     // Датаграмм одного отправителя
+HANDLE reasm_mutex;                // Мьютекс для работы с буферами
+
+/**
+@brief Ищет буфер датаграммы, освобождая буферы с истекшим временем
+@param src Адрес отправителя
+@param dst Адрес получателя
+@param id Идентификатор датаграммы
+@param protocol Протокол датаграммы
+@param now Текущее время
+@return Буфер сборки или NULL, если фрагмент надо отбросить
+*/
+ReasmBuffer *get_reasm_buffer(uint32_t src, uint32_t dst, uint16_t id,
+	uint8_t protocol, uint32_t now);
+
+void init_reasm(uint32_t memory, uint32_t timeout, uint16_t per_source)
+{
+	reasm_count = memory / (sizeof(ReasmBuffer) + REASM_MAX_HEADER +
+		REASM_MAX_DATA);
+	if (reasm_count == 0)
+		return;
+	frag_timeout = timeout;
+	frag_per_source = per_source;
+	reasm_mutex = CreateMutex(NULL, FALSE, NULL);
+	// Вся память выделяется заранее, фрагменты её не запрашивают
+	reasm_buffers = (ReasmBuffer *)calloc(reasm_count, sizeof(ReasmBuffer));
+	for (uint32_t i = 0; i < reasm_count; i++)
+		reasm_buffers[i].data = (char *)malloc(REASM_MAX_HEADER +
+			REASM_MAX_DATA);
+}
+
+uint8_t reassemble_package(const char *buffer, size_t count, ReasmBuffer **rb)
+{
+	const uint8_t *p = (const uint8_t *)buffer;
+	uint16_t offset = (p[6] << 8) | p[7];
+	if (reasm_count == 0 || (offset & (IP_FLAG_MF | IP_FRAGMENT_MASK)) == 0)
+		return REASM_PASS;
+	// Границы данных фрагмента
+	uint16_t header_len = (p[0] & 0x0F) << 2;
+	size_t len = (p[2] << 8) | p[3];
+	if (len > count)
+		len = count;
+	uint32_t beg = (offset & IP_FRAGMENT_MASK) << 3;
+	if (header_len < 20 || len <= header_len)
+		return REASM_HOLD;
+	uint32_t end = beg + len - header_len;
+	// Все фрагменты, кроме последнего, кратны 8 байтам
+	if (offset & IP_FLAG_MF)
+		end &= ~7u;
+	if (end <= beg || end > REASM_MAX_DATA - header_len)
+		return REASM_HOLD;
+	
+	uint8_t res = REASM_HOLD;
+	WaitForSingleObject(reasm_mutex, INFINITE);
+	uint32_t src, dst;
+	memcpy(&src, p + 12, sizeof(src));
+	memcpy(&dst, p + 16, sizeof(dst));
+	ReasmBuffer *b = get_reasm_buffer(src, dst, (p[4] << 8) | p[5], p[9],
+		GetTickCount());
+	// Когда длина датаграммы известна, фрагмент за её концом или другой
+	// последний фрагмент отбрасывается: иначе он заполнил бы карту вместо
+	// пропущенных блоков
+	if (b != NULL && b->total > 0 && (end > b->total ||
+		((offset & IP_FLAG_MF) == 0 && end != b->total)))
+		b = NULL;
+	if (b != NULL)
+	{
+		// Заголовок берется из первого фрагмента
+		if (beg == 0 && b->header_len == 0)
+		{
+			b->header_len = header_len;
+			memcpy(b->data + REASM_MAX_HEADER - header_len, p, header_len);
+		}
+		memcpy(b->data + REASM_MAX_HEADER + beg, p + header_len, end - beg);
+		// Учет принятых блоков с учетом перекрытий
+		for (uint32_t u = beg >> 3; u < (end + 7) >> 3; u++)
+			if ((b->map[u >> 3] & (1 << (u & 7))) == 0)
+			{
+				b->map[u >> 3] |= 1 << (u & 7);
+				b->units++;
+			}
+		if ((offset & IP_FLAG_MF) == 0 && b->total == 0)
+		{
+			b->total = end;
+			// Блоки, принятые за концом датаграммы до последнего фрагмента,
+			// не учитываются
+			b->units = 0;
+			for (uint32_t u = 0; u < (end + 7) >> 3; u++)
+				if (b->map[u >> 3] & (1 << (u & 7)))
+					b->units++;
+		}
+		// Датаграмма собрана, если приняты первый, последний и все между ними
+		if (b->header_len > 0 && b->total > 0 && 
+			b->units == (b->total + 7) >> 3)
+		{
+			b->package = b->data + REASM_MAX_HEADER - b->header_len;
+			b->size = b->header_len + b->total;
+			b->package[2] = b->size >> 8;
+			b->package[3] = b->size & 0xFF;
+			b->package[6] = 0;
+			b->package[7] = 0;
+			b->state = RSTATE_OUT;
+			*rb = b;
+			res = REASM_DONE;
+		}
+	}
+	ReleaseMutex(reasm_mutex);
+	return res;
+}
+
+ReasmBuffer *get_reasm_buffer(uint32_t src, uint32_t dst, uint16_t id,
+	uint8_t protocol, uint32_t now)
+{
+	ReasmBuffer *found = NULL;
+	ReasmBuffer *free_b = NULL;
+	ReasmBuffer *oldest = NULL;
+	uint16_t src_count = 0;
+	for (uint32_t i = 0; i < reasm_count; i++)
+	{
+		ReasmBuffer *b = reasm_buffers + i;
+		// Недособранные датаграммы удаляются по истечении времени
+		if (b->state == RSTATE_BUSY && now - b->time > frag_timeout)
+			b->state = RSTATE_FREE;
+		if (b->state == RSTATE_FREE)
+		{
+			if (free_b == NULL)
+				free_b = b;
+		}
+		else if (b->state == RSTATE_BUSY)
+		{
+			if (b->src == src && b->dst == dst && b->id == id &&
+				b->protocol == protocol)
+				found = b;
+			if (b->src == src)
+				src_count++;
+			if (oldest == NULL || now - b->time > now - oldest->time)
+				oldest = b;
+		}
+	}
+	if (found != NULL)
+		return found;
+	// Один отправитель не может занять все буферы
+	if (src_count >= frag_per_source)
+		return NULL;
+	// При нехватке памяти вытесняется самая старая сборка
+	if (free_b == NULL)
+		free_b = oldest;
+	if (free_b != NULL)
+	{
+		free_b->state = RSTATE_BUSY;
+		free_b->src = src;
+		free_b->dst = dst;
+		free_b->id = id;
+		free_b->protocol = protocol;
+		free_b->time = now;
+		free_b->header_len = 0;
+		free_b->total = 0;
+		free_b->units = 0;
+		ZeroMemory(free_b->map, sizeof(free_b->map));
+	}
+	return free_b;
+}
+
+void release_reasm_buffer(ReasmBuffer *rb)
+{
+	WaitForSingleObject(reasm_mutex, INFINITE);
+	rb->state = RSTATE_FREE;
+	ReleaseMutex(reasm_mutex);
+}
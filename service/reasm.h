@@ -0,0 +1,67 @@
+/******************************************************************************
+     * File: reasm.h
+     * Description: Сборка фрагментированных IPv4-пакетов в ограниченной памяти.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __REASM_H__
+#define __REASM_H__
+
+#include "settings.h"
+
+#define REASM_MAX_HEADER 60     // Максимальная длина IP-заголовка
+#define REASM_MAX_DATA   65535  // Максимальная длина данных датаграммы
+#define REASM_MAP_SIZE   (REASM_MAX_DATA / 64 + 1) // Карта 8-байтовых блоков
+// Результат обработки пакета
+#define REASM_PASS 0x00  // Пакет не фрагментирован
+#define REASM_HOLD 0x01  // Фрагмент сохранен или отброшен
+#define REASM_DONE 0x02  // Датаграмма собрана
+// Состояние буфера сборки
+#define RSTATE_FREE 0x00 // Свободен
+#define RSTATE_BUSY 0x01 // Идет сборка
+#define RSTATE_OUT  0x02 // Собранная датаграмма передана на анализ
+
+// Буфер сборки одной датаграммы
+typedef struct ReasmBuffer
+{
+	uint8_t state;        // Состояние буфера
+	uint8_t protocol;     // Протокол датаграммы
+	uint16_t id;          // Идентификатор датаграммы
+	uint32_t src;         // Адрес отправителя
+	uint32_t dst;         // Адрес получателя
+	uint32_t time;        // Время приёма первого фрагмента
+	uint16_t header_len;  // Длина заголовка (0 - первый фрагмент не принят)
+	uint32_t total;       // Длина данных (0 - последний фрагмент не принят)
+	uint32_t units;       // Количество принятых 8-байтовых блоков
+	uint8_t map[REASM_MAP_SIZE]; // Принятые блоки
+	char *package;        // Собранная датаграмма
+	size_t size;          // Длина собранной датаграммы
+	char *data;           // Память под заголовок и данные
+} ReasmBuffer;
+
+/**
+@brief Выделяет буферы сборки в пределах заданного объема памяти
+@param memory Объем памяти в байтах (0 - сборка отключена)
+@param timeout Время ожидания недостающих фрагментов (мс)
+@param per_source Максимальное количество датаграмм одного отправителя
+*/
+void init_reasm(uint32_t memory, uint32_t timeout, uint16_t per_source);
+
+/**
+@brief Добавляет фрагмент в сборку датаграммы
+@param buffer Содержимое пакета, начиная с IP-заголовка
+@param count Количество принятых байт
+@param rb Для записи буфера собранной датаграммы
+@return REASM_PASS, REASM_HOLD или REASM_DONE
+*/
+uint8_t reassemble_package(const char *buffer, size_t count, ReasmBuffer **rb);
+
+/**
+@brief Освобождает буфер после передачи собранной датаграммы на анализ
+@param rb Буфер сборки
+*/
+void release_reasm_buffer(ReasmBuffer *rb);
+
+#endif
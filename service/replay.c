@@ -0,0 +1,519 @@
+/******************************************************************************
+     * File: replay.c
+     * Description: Воспроизведение сохранённого трафика из файлов pcap/pcapng.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "replay.h"
+
+const char **replay_files = NULL; // Имена файлов для воспроизведения
+uint16_t replay_count = 0;  // Количество файлов
+
+// Параметры из файла конфигурации
+uint8_t  replay_access = RACCESS_STREAM; // Способ чтения файлов
+Bool     replay_pacing = FALSE; // Соблюдать ли интервалы между пакетами
+uint16_t replay_repeat = 1;     // Сколько раз воспроизвести каждый файл
+
+/**
+@brief Поток для воспроизведения файлов
+*/
+DWORD WINAPI rp_thread(LPVOID ptr);
+
+/**
+@brief Получает указатель на очередные байты файла
+@param rf Файл воспроизведения
+@param size Сколько байт требуется
+@return Указатель на данные или NULL, если файл закончился
+*/
+const char *read_replay_bytes(ReplayFile *rf, size_t size);
+
+/**
+@brief Пропускает байты файла
+@param rf Файл воспроизведения
+@param size Сколько байт пропустить
+@return TRUE - байты пропущены
+*/
+Bool skip_replay_bytes(ReplayFile *rf, size_t size);
+
+/**
+@brief Читает 16-битное значение с учётом порядка байт файла
+*/
+uint16_t get_replay_u16(const ReplayFile *rf, const char *p);
+
+/**
+@brief Читает 32-битное значение с учётом порядка байт файла
+*/
+uint32_t get_replay_u32(const ReplayFile *rf, const char *p);
+
+/**
+@brief Читает блок описания интерфейса pcapng
+@param rf Файл воспроизведения
+@param body Тело блока
+@param len Длина тела блока
+*/
+void read_replay_idb(ReplayFile *rf, const char *body, uint32_t len);
+
+/**
+@brief Находит начало IP-заголовка внутри кадра канального уровня
+@param rp Пакет, содержащий кадр (изменяется на IP-пакет)
+@param link Тип канального уровня
+@return TRUE - кадр содержит пакет IPv4
+*/
+Bool strip_link_header(ReplayPacket *rp, uint16_t link);
+
+/**
+@brief Воспроизводит файл один раз и выводит пропускную способность
+@param rf Файл воспроизведения
+@param adapter Данные адаптера, от имени которого поступают пакеты
+*/
+void replay_file(ReplayFile *rf, AdapterData *adapter);
+
+/**
+@brief Получает текущее время в наносекундах
+*/
+uint64_t get_replay_time();
+
+void run_replay()
+{
+	const char *list[REPLAY_MAX_FILES];
+	
+	// Получение параметров
+	while (is_reading_settings_section("Replay"))
+	{
+		const char *name = read_setting_name();
+		if (strcmp(name, "files") == 0)
+			while (is_reading_setting_value())
+			{
+				const char *file = read_setting_s();
+				if (replay_count < REPLAY_MAX_FILES)
+					list[replay_count++] = file;
+			}
+		else if (strcmp(name, "access") == 0)
+		{
+			const char *access = read_setting_s();
+			if (strcmp(access, "mmap") == 0)
+				replay_access = RACCESS_MMAP;
+			else if (strcmp(access, "stream") != 0)
+				print_errlogf("Unknown replay access \"%s\", stream is used",
+					access);
+		}
+		else if (strcmp(name, "pacing") == 0)
+			replay_pacing = read_setting_u() != 0;
+		else if (strcmp(name, "repeat") == 0)
+			replay_repeat = read_setting_u();
+		else
+			print_not_used(name);
+	}
+	
+	if (replay_count > 0)
+	{
+		replay_files = (const char **)malloc(replay_count * sizeof(char *));
+		memcpy(replay_files, list, replay_count * sizeof(char *));
+		HANDLE hThread = CreateThread(NULL, 0, rp_thread, NULL, 0, NULL);
+		if (hThread == NULL)
+			print_errlog("Failed to create replay thread!\n");
+		place_thread(hThread, TCLASS_SNIFFER, 0, "Replay");
+	}
+}
+
+ReplayFile *open_replay_file(const char *name, uint8_t access)
+{
+	ReplayFile *rf = (ReplayFile *)malloc(sizeof(ReplayFile));
+	ZeroMemory(rf, sizeof(ReplayFile));
+	rf->name = name;
+	if (access == RACCESS_MMAP)
+	{
+		// Отображение всего файла в память
+		LARGE_INTEGER size;
+		rf->hFile = CreateFile(name, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (rf->hFile != INVALID_HANDLE_VALUE && GetFileSizeEx(rf->hFile, &size)
+			&& size.QuadPart > 0)
+		{
+			rf->hMap = CreateFileMapping(rf->hFile, NULL, PAGE_READONLY,
+				0, 0, NULL);
+			if (rf->hMap != NULL)
+				rf->map = (const char *)MapViewOfFile(rf->hMap, FILE_MAP_READ,
+					0, 0, 0);
+		}
+		if (rf->map == NULL)
+		{
+			print_errlogf("Failed to map replay file \"%s\"", name);
+			close_replay_file(rf);
+			return NULL;
+		}
+		rf->cursor = rf->map;
+		rf->map_end = rf->map + size.QuadPart;
+	}
+	else
+	{
+		rf->file = fopen(name, "rb");
+		if (rf->file == NULL)
+		{
+			print_errlogf("Failed to open replay file \"%s\"", name);
+			close_replay_file(rf);
+			return NULL;
+		}
+		rf->buffer_size = PACKAGE_BUFFER_SIZE;
+		rf->buffer = (char *)malloc(rf->buffer_size);
+	}
+	
+	// Определение формата по первым байтам
+	const char *p = read_replay_bytes(rf, 4);
+	uint32_t magic = p != NULL ? *(uint32_t *)p : 0;
+	if (p == NULL)
+	{
+		print_errlogf("Replay file \"%s\" is empty", name);
+		close_replay_file(rf);
+		return NULL;
+	}
+	else if (magic == PCAPNG_SHB)
+	{
+		// Заголовок секции обрабатывается при чтении пакетов
+		rf->is_ng = TRUE;
+		if (rf->map != NULL)
+			rf->cursor = rf->map;
+		else
+			fseek(rf->file, 0, SEEK_SET);
+	}
+	else
+	{
+		rf->swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+		magic = get_replay_u32(rf, p);
+		p = read_replay_bytes(rf, 20);
+		if ((magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS) || p == NULL)
+		{
+			print_errlogf("Unknown format of replay file \"%s\"", name);
+			close_replay_file(rf);
+			return NULL;
+		}
+		rf->ts_mul = magic == PCAP_MAGIC_US ? 1000 : 1;
+		rf->link[0] = get_replay_u32(rf, p + 16);
+		rf->if_count = 1;
+	}
+	return rf;
+}
+
+Bool read_replay_packet(ReplayFile *rf, ReplayPacket *rp)
+{
+	const char *p;
+	while (TRUE)
+	{
+		uint16_t link;
+		if (!rf->is_ng)
+		{
+			// Заголовок записи pcap
+			p = read_replay_bytes(rf, 16);
+			if (p == NULL)
+				return FALSE;
+			uint32_t ts_sec  = get_replay_u32(rf, p);
+			uint32_t ts_frac = get_replay_u32(rf, p + 4);
+			uint32_t caplen  = get_replay_u32(rf, p + 8);
+			rp->ts = (uint64_t)ts_sec * 1000000000 + 
+				(uint64_t)ts_frac * rf->ts_mul;
+			rp->size = caplen;
+			if (caplen > REPLAY_MAX_CAPLEN)
+			{
+				print_errlogf("Replay file \"%s\" is damaged", rf->name);
+				return FALSE;
+			}
+			rp->data = read_replay_bytes(rf, caplen);
+			if (rp->data == NULL)
+				return FALSE;
+			link = rf->link[0];
+		}
+		else
+		{
+			// Заголовок блока pcapng
+			p = read_replay_bytes(rf, 8);
+			if (p == NULL)
+				return FALSE;
+			uint32_t type = *(uint32_t *)p;
+			if (type == PCAPNG_SHB)
+			{
+				// Порядок байт определяется маркером секции
+				uint32_t total = *(uint32_t *)(p + 4);
+				p = read_replay_bytes(rf, 4);
+				if (p == NULL)
+					return FALSE;
+				rf->swapped = *(uint32_t *)p != PCAPNG_BOM;
+				rf->if_count = 0;
+				total = get_replay_u32(rf, (const char *)&total);
+				if (total < 12 || !skip_replay_bytes(rf, total - 12))
+					return FALSE;
+				continue;
+			}
+			type = get_replay_u32(rf, p);
+			uint32_t total = get_replay_u32(rf, p + 4);
+			if (total < 12 || total > REPLAY_MAX_CAPLEN)
+			{
+				print_errlogf("Replay file \"%s\" is damaged", rf->name);
+				return FALSE;
+			}
+			const char *body = read_replay_bytes(rf, total - 8);
+			if (body == NULL)
+				return FALSE;
+			uint32_t len = total - 12;
+			uint32_t iface = 0;
+			uint64_t ts = 0;
+			if (type == PCAPNG_IDB)
+			{
+				read_replay_idb(rf, body, len);
+				continue;
+			}
+			else if (type == PCAPNG_EPB && len >= 20)
+			{
+				iface = get_replay_u32(rf, body);
+				ts = ((uint64_t)get_replay_u32(rf, body + 4) << 32) |
+					get_replay_u32(rf, body + 8);
+				rp->size = get_replay_u32(rf, body + 12);
+				rp->data = body + 20;
+			}
+			else if (type == PCAPNG_PB && len >= 20)
+			{
+				iface = get_replay_u16(rf, body);
+				ts = ((uint64_t)get_replay_u32(rf, body + 4) << 32) |
+					get_replay_u32(rf, body + 8);
+				rp->size = get_replay_u32(rf, body + 12);
+				rp->data = body + 20;
+			}
+			else if (type == PCAPNG_SPB && len >= 4)
+			{
+				rp->size = get_replay_u32(rf, body);
+				rp->data = body + 4;
+			}
+			else
+				continue;
+			if (iface >= rf->if_count || rp->data + rp->size > body + len)
+				continue;
+			// Перевод времени интерфейса в наносекунды
+			uint64_t resol = rf->resol[iface];
+			rp->ts = ts / resol * 1000000000 +
+				ts % resol * 1000000000 / resol;
+			link = rf->link[iface];
+		}
+		if (strip_link_header(rp, link))
+			return TRUE;
+	}
+}
+
+void close_replay_file(ReplayFile *rf)
+{
+	if (rf->map != NULL)
+		UnmapViewOfFile(rf->map);
+	if (rf->hMap != NULL)
+		CloseHandle(rf->hMap);
+	if (rf->hFile != NULL && rf->hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(rf->hFile);
+	if (rf->file != NULL)
+		fclose(rf->file);
+	free(rf->buffer);
+	free(rf);
+}
+
+DWORD WINAPI rp_thread(LPVOID ptr)
+{
+	for (uint16_t i = 0; i < replay_count; i++)
+	{
+		// Пакеты файла записываются в лог с именем файла
+		const char *name = replay_files[i];
+		const char *base = name;
+		for (const char *p = name; *p != '\0'; p++)
+			if (*p == '\\' || *p == '/')
+				base = p + 1;
+		AdapterData *adapter = (AdapterData *)malloc(sizeof(AdapterData));
+		adapter->addr = name;
+		adapter->fid = add_log_file(base);
+		register_adapter(adapter);
+		for (uint16_t j = 0; j < replay_repeat; j++)
+		{
+			ReplayFile *rf = open_replay_file(name, replay_access);
+			if (rf == NULL)
+				break;
+			replay_file(rf, adapter);
+			close_replay_file(rf);
+		}
+	}
+	print_msglog("Replay finished.");
+	flush_slot_cache();
+	return 0;
+}
+
+void replay_file(ReplayFile *rf, AdapterData *adapter)
+{
+	ReplayPacket rp;
+	uint64_t packets = 0, bytes = 0;
+	uint64_t first_ts = 0;
+	uint64_t start = get_replay_time();
+	// Счетчик отброшенных пакетов общий для повторов файла
+	uint32_t lost = (uint32_t)adapter->lost;
+	print_msglogf("Replaying \"%s\"...\n", rf->name);
+	while (read_replay_packet(rf, &rp))
+	{
+		if (!is_package_accepted(rp.data, rp.size) ||
+			!assemble_package(adapter, rp.data, rp.size))
+			continue;
+		// Соблюдение исходных интервалов между пакетами
+		if (replay_pacing)
+		{
+			if (packets == 0)
+				first_ts = rp.ts;
+			uint64_t offset = rp.ts > first_ts ? rp.ts - first_ts : 0;
+			uint64_t now = get_replay_time() - start;
+			while (now < offset)
+			{
+				if (offset - now > 2000000)
+					Sleep((offset - now) / 1000000 - 1);
+				now = get_replay_time() - start;
+			}
+		}
+		analyze_package(adapter, rp.data, rp.size);
+		packets++;
+		bytes += rp.size;
+	}
+	// Ожидание обработки поставленных в очередь пакетов
+	while (!is_analyzers_idle())
+		Sleep(1);
+	double seconds = (get_replay_time() - start) / 1e9;
+	if (seconds <= 0)
+		seconds = 1e-9;
+	// Скорость считается по проверенным пакетам: отброшенные при нехватке
+	// места анализаторы не разбирали
+	uint64_t dropped = (uint32_t)adapter->lost - lost;
+	uint64_t analyzed = packets > dropped ? packets - dropped : 0;
+	print_msglogf("Replay of \"%s\": %llu packets, %llu bytes, %llu dropped "
+		"in %.3f s (%.0f analyzed packets/s, %.0f offered bytes/s)\n",
+		rf->name, (unsigned long long)packets, (unsigned long long)bytes,
+		(unsigned long long)dropped, seconds, analyzed / seconds,
+		bytes / seconds);
+}
+
+const char *read_replay_bytes(ReplayFile *rf, size_t size)
+{
+	const char *p = NULL;
+	if (rf->map != NULL)
+	{
+		// Данные берутся прямо из отображения без копирования
+		if (size <= (size_t)(rf->map_end - rf->cursor))
+		{
+			p = rf->cursor;
+			rf->cursor += size;
+		}
+	}
+	else
+	{
+		if (size > rf->buffer_size)
+		{
+			rf->buffer_size = size;
+			rf->buffer = (char *)realloc(rf->buffer, size);
+		}
+		if (size == 0 || fread(rf->buffer, size, 1, rf->file) == 1)
+			p = rf->buffer;
+	}
+	return p;
+}
+
+Bool skip_replay_bytes(ReplayFile *rf, size_t size)
+{
+	if (rf->map != NULL)
+		return read_replay_bytes(rf, size) != NULL;
+	return fseek(rf->file, size, SEEK_CUR) == 0;
+}
+
+uint16_t get_replay_u16(const ReplayFile *rf, const char *p)
+{
+	uint16_t v = *(uint16_t *)p;
+	if (rf->swapped)
+		v = (v << 8) | (v >> 8);
+	return v;
+}
+
+uint32_t get_replay_u32(const ReplayFile *rf, const char *p)
+{
+	uint32_t v = *(uint32_t *)p;
+	if (rf->swapped)
+		v = (v << 24) | ((v << 8) & 0xFF0000) | ((v >> 8) & 0xFF00) | (v >> 24);
+	return v;
+}
+
+void read_replay_idb(ReplayFile *rf, const char *body, uint32_t len)
+{
+	if (rf->if_count >= PCAPNG_MAX_IF || len < 8)
+		return;
+	uint16_t i = rf->if_count++;
+	rf->link[i] = get_replay_u16(rf, body);
+	rf->resol[i] = 1000000; // По умолчанию микросекунды
+	// Поиск параметра if_tsresol
+	const char *opt = body + 8;
+	const char *end = body + len;
+	while (opt + 4 <= end)
+	{
+		uint16_t code = get_replay_u16(rf, opt);
+		uint16_t size = get_replay_u16(rf, opt + 2);
+		if (code == 0)
+			break;
+		if (code == 9 && size == 1)
+		{
+			uint8_t v = opt[4];
+			uint64_t resol = 1;
+			if (v & 0x80)
+				resol <<= v & 0x3F;
+			else
+				while (v-- > 0)
+					resol *= 10;
+			rf->resol[i] = resol;
+		}
+		opt += 4 + ((size + 3) & ~3);
+	}
+}
+
+Bool strip_link_header(ReplayPacket *rp, uint16_t link)
+{
+	const uint8_t *p = (const uint8_t *)rp->data;
+	uint32_t shift = 0;
+	switch (link)
+	{
+		case LINKTYPE_NULL:
+			shift = 4;
+			break;
+		case LINKTYPE_ETHERNET:
+			shift = 12;
+			// Пропуск меток VLAN
+			while (shift + 2 <= rp->size &&
+				(p[shift] == 0x81 || p[shift] == 0x88) &&
+				(p[shift + 1] == 0x00 || p[shift + 1] == 0xA8))
+				shift += 4;
+			if (shift + 2 > rp->size || p[shift] != 0x08 || p[shift + 1] != 0x00)
+				return FALSE;
+			shift += 2;
+			break;
+		case LINKTYPE_SLL:
+			if (rp->size < 16 || p[14] != 0x08 || p[15] != 0x00)
+				return FALSE;
+			shift = 16;
+			break;
+		case LINKTYPE_RAW_OLD:
+		case LINKTYPE_RAW:
+		case LINKTYPE_IPV4:
+			break;
+		default:
+			return FALSE;
+	}
+	if (shift + sizeof(IPHeader) > rp->size || (p[shift] >> 4) != 4)
+		return FALSE;
+	rp->data += shift;
+	rp->size -= shift;
+	return TRUE;
+}
+
+uint64_t get_replay_time()
+{
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 +
+		(uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 /
+		frequency.QuadPart;
+}
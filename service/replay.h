@@ -0,0 +1,91 @@
+/******************************************************************************
+     * File: replay.h
+     * Description: Воспроизведение сохранённого трафика из файлов pcap/pcapng.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "analyzer.h"
+
+#define PCAP_MAGIC_US    0xA1B2C3D4 // pcap с микросекундами
+#define PCAP_MAGIC_NS    0xA1B23C4D // pcap с наносекундами
+#define PCAPNG_SHB       0x0A0D0D0A // Заголовок секции pcapng
+#define PCAPNG_IDB       0x00000001 // Описание интерфейса
+#define PCAPNG_PB        0x00000002 // Устаревший блок пакета
+#define PCAPNG_SPB       0x00000003 // Простой блок пакета
+#define PCAPNG_EPB       0x00000006 // Расширенный блок пакета
+#define PCAPNG_BOM       0x1A2B3C4D // Маркер порядка байт секции
+#define PCAPNG_MAX_IF            16 // Максимальное количество интерфейсов
+#define REPLAY_MAX_FILES        256 // Максимальное количество файлов
+#define REPLAY_MAX_CAPLEN    262144 // Предел размера записи pcap
+// Тип канального уровня
+#define LINKTYPE_NULL      0  // Петля BSD (4 байта семейства адресов)
+#define LINKTYPE_ETHERNET  1  // Ethernet II
+#define LINKTYPE_RAW_OLD  12  // IP без заголовка (OpenBSD)
+#define LINKTYPE_RAW     101  // IP без заголовка
+#define LINKTYPE_SLL     113  // Linux cooked capture
+#define LINKTYPE_IPV4    228  // IPv4 без заголовка
+// Способ чтения файла
+#define RACCESS_STREAM 0x00  // Последовательное чтение
+#define RACCESS_MMAP   0x01  // Отображение файла в память
+
+// Открытый файл воспроизведения
+typedef struct ReplayFile
+{
+	const char *name;     // Имя файла
+	Bool is_ng;           // Формат pcapng
+	Bool swapped;         // Порядок байт отличается от текущего
+	uint32_t ts_mul;      // Множитель для перевода времени pcap в нс
+	uint16_t link[PCAPNG_MAX_IF];  // Канальный уровень интерфейсов
+	uint64_t resol[PCAPNG_MAX_IF]; // Единиц времени интерфейса в секунде
+	uint16_t if_count;    // Количество описанных интерфейсов
+	FILE *file;           // Файл для последовательного чтения
+	char *buffer;         // Буфер для последовательного чтения
+	size_t buffer_size;   // Размер буфера
+	HANDLE hFile;         // Файл для отображения в память
+	HANDLE hMap;          // Отображение файла
+	const char *map;      // Начало отображения
+	const char *cursor;   // Текущая позиция в отображении
+	const char *map_end;  // Конец отображения
+} ReplayFile;
+
+// Пакет, извлечённый из файла
+typedef struct ReplayPacket
+{
+	const char *data;     // Начало IP-заголовка
+	uint32_t size;        // Сохранённый размер от IP-заголовка
+	uint64_t ts;          // Время захвата в наносекундах
+} ReplayPacket;
+
+/**
+@brief Запускает воспроизведение файлов из секции [Replay]
+*/
+void run_replay();
+
+/**
+@brief Открывает файл pcap/pcapng и читает его заголовок
+@param name Имя файла
+@param access Способ чтения файла
+@return Открытый файл или NULL
+*/
+ReplayFile *open_replay_file(const char *name, uint8_t access);
+
+/**
+@brief Читает следующий IPv4 пакет файла
+@param rf Файл воспроизведения
+@param rp Для записи сведений о пакете
+@return TRUE - пакет прочитан, FALSE - конец файла
+*/
+Bool read_replay_packet(ReplayFile *rf, ReplayPacket *rp);
+
+/**
+@brief Закрывает файл и освобождает ресурсы
+@param rf Файл воспроизведения
+*/
+void close_replay_file(ReplayFile *rf);
+
+#endif
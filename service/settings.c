@@ -189,7 +189,7 @@ const char *read_setting_s()
 	// Копирование параметра в новый массив
 	if (i > 0)
 	{
-		char *res = (char *)malloc(i);
+		char *res = (char *)malloc(i + 1);
 		strcpy(res, settings_buffer);
 		return res;
 	}
@@ -8,21 +8,135 @@
 
 #include "sniffer.h"
 
-char package_buffer[PACKAGE_BUFFER_SIZE];
 AdapterList *beg_alist = NULL;  // Ссылки на список адаптеров
 AdapterList *end_alist = NULL;
- 
+HANDLE mux_port = NULL;         // Общий порт завершения режима mux
+uint32_t mux_adapter_count = 0; // Количество адаптеров в режиме mux
+
+// Параметры из файла конфигурации
+uint32_t ring_block_size  = 1048576; // Размер блока кольца захвата в байтах
+uint32_t ring_frame_count = 16;      // Количество кадров в блоке
+uint32_t ring_block_count = 4;       // Количество блоков в кольце
+uint32_t ring_timeout     = 100;     // Время ожидания заполнения блока (мс)
+uint32_t batch_size       = 32;      // Количество пакетов в выборке
+uint32_t batch_timeout    = 10;      // Время ожидания первого пакета (мс)
+uint32_t umem_frame_size  = 2048;    // Размер кадра UMEM в байтах
+uint32_t umem_frame_count = 4096;    // Количество кадров UMEM адаптера
+uint32_t mux_threads      = 0;       // Потоки приёма mux (0 - по числу ЦП)
+uint32_t mux_frame_count  = 8;       // Кадры приёма адаптера в режиме mux
+uint32_t mux_frame_size   = 2048;    // Размер кадра приёма в режиме mux
+uint32_t dedup_window     = 0;       // Окно подавления повторов (мс)
+uint32_t dedup_table_size = 65536;   // Записей в таблице повторов
+uint32_t dedup_bytes      = 64;      // Байт данных пакета в ключе повтора
+uint32_t reasm_memory     = 8388608; // Память под сборку фрагментов
+uint32_t reasm_timeout    = 3000;    // Время ожидания фрагментов (мс)
+uint32_t reasm_per_source = 16;      // Датаграмм в сборке от отправителя
+uint32_t jumbo_peek       = 0;       // Узнавать размер пакета до приёма
+
 /**
-@brief Подключение к адаптеру для прослушивания
+@brief Добавляет адаптер в список прослушиваемых
 @param addr - Адрес адаптера
 */
-void connection_to_adapter(const char *addr);
+void add_adapter(const char *addr);
+
+/**
+@brief Подключение к адаптеру для прослушивания
+@param al - Сведения об адаптере
+@param index - Номер адаптера для размещения потока приёма
+*/
+void connection_to_adapter(AdapterList *al, uint32_t index);
+
+/**
+@brief Определяет режим захвата по его названию
+@param name - Название режима
+@return Идентификатор режима
+*/
+uint8_t get_capture_mode(const char *name);
+
+/**
+@brief Создает сокет, подключенный к адаптеру в режиме promiscuous
+@param data - Данные адаптера
+@param flags - Флаги создания сокета
+@return Сокет адаптера
+*/
+SOCKET open_adapter_socket(AdapterData *data, DWORD flags);
+
+/**
+@brief Привязывает сокет адаптера к новому порту завершения
+@param s - Сокет адаптера
+@param data - Данные адаптера
+@return Порт завершения
+*/
+HANDLE open_completion_port(SOCKET s, AdapterData *data);
+
+/**
+@brief Создает кольцо блоков захвата и запускает приём во все кадры
+@param data - Данные адаптера
+@return Кольцо захвата
+*/
+CaptureRing *create_capture_ring(AdapterData *data);
+
+/**
+@brief Запускает асинхронный приём пакета в кадр кольца
+@param s - Сокет адаптера
+@param frame - Кадр для приёма
+*/
+void post_ring_frame(SOCKET s, RingFrame *frame);
+
+/**
+@brief Создает область кадров UMEM для приёма без копирования
+@param data - Данные адаптера
+@return Состояние приёма
+*/
+UmemCapture *create_umem_capture(AdapterData *data);
+
+/**
+@brief Принимает пакет из сокета в слот, не обрезая его
+@note Пакет больше слота отбрасывается; при jumbo_peek размер пакета
+узнается заранее и такой пакет принимается в слот большого пакета,
+если они есть
+@param s - Сокет адаптера
+@param slot - Место для приёма
+@return Количество принятых байт (0 - пакет отброшен)
+*/
+int receive_slot(SOCKET s, PackageSlot *slot);
 
 /**
 @brief Поток для анализа трафика
 */
 DWORD WINAPI sn_thread(LPVOID ptr);
 
+/**
+@brief Поток для анализа трафика через кольцо блоков
+*/
+DWORD WINAPI sn_ring_thread(LPVOID ptr);
+
+/**
+@brief Поток для анализа трафика выборками пакетов
+*/
+DWORD WINAPI sn_batch_thread(LPVOID ptr);
+
+/**
+@brief Подключает адаптер к общему порту завершения режима mux
+@param al - Сведения об адаптере
+*/
+void add_mux_adapter(AdapterList *al);
+
+/**
+@brief Запускает общие потоки приёма для адаптеров в режиме mux
+*/
+void run_capture_mux();
+
+/**
+@brief Поток для анализа трафика в кадрах UMEM
+*/
+DWORD WINAPI sn_umem_thread(LPVOID ptr);
+
+/**
+@brief Поток приёма пакетов всех адаптеров в режиме mux
+*/
+DWORD WINAPI sn_mux_thread(LPVOID ptr);
+
 void run_sniffer()
 {
 	// Инициализация сокетов
@@ -32,6 +146,10 @@ void run_sniffer()
 	
 	PList *tcp_port = create_plist();
 	PList *udp_port = create_plist();
+	PList *modes = create_plist();
+	PList *weights = create_plist();
+	FilterConfig filter;
+	ZeroMemory(&filter, sizeof(filter));
 	
 	// Получение параметров
 	while (is_reading_settings_section("Sniffer"))
@@ -39,30 +157,135 @@ void run_sniffer()
 		const char *name = read_setting_name();
 		if (strcmp(name, "adapters") == 0)
 			while (is_reading_setting_value())
-				connection_to_adapter(read_setting_s());
+				add_adapter(read_setting_s());
+		else if (strcmp(name, "capture_modes") == 0)
+			while (is_reading_setting_value())
+				add_in_plist(modes, get_capture_mode(read_setting_s()));
+		else if (strcmp(name, "adapter_weights") == 0)
+			while (is_reading_setting_value())
+				add_in_plist(weights, read_setting_u());
+		else if (strcmp(name, "ring_block_size") == 0)
+			ring_block_size = read_setting_u();
+		else if (strcmp(name, "ring_frame_count") == 0)
+			ring_frame_count = read_setting_u();
+		else if (strcmp(name, "ring_block_count") == 0)
+			ring_block_count = read_setting_u();
+		else if (strcmp(name, "ring_timeout") == 0)
+			ring_timeout = read_setting_u();
+		else if (strcmp(name, "batch_size") == 0)
+			batch_size = read_setting_u();
+		else if (strcmp(name, "batch_timeout") == 0)
+			batch_timeout = read_setting_u();
+		else if (strcmp(name, "umem_frame_size") == 0)
+			umem_frame_size = read_setting_u();
+		else if (strcmp(name, "umem_frame_count") == 0)
+			umem_frame_count = read_setting_u();
+		else if (strcmp(name, "mux_threads") == 0)
+			mux_threads = read_setting_u();
+		else if (strcmp(name, "mux_frame_count") == 0)
+			mux_frame_count = read_setting_u();
+		else if (strcmp(name, "mux_frame_size") == 0)
+			mux_frame_size = read_setting_u();
+		else if (strcmp(name, "dedup_window") == 0)
+			dedup_window = read_setting_u();
+		else if (strcmp(name, "dedup_table_size") == 0)
+			dedup_table_size = read_setting_u();
+		else if (strcmp(name, "dedup_bytes") == 0)
+			dedup_bytes = read_setting_u();
+		else if (strcmp(name, "reasm_memory") == 0)
+			reasm_memory = read_setting_u();
+		else if (strcmp(name, "reasm_timeout") == 0)
+			reasm_timeout = read_setting_u();
+		else if (strcmp(name, "reasm_per_source") == 0)
+			reasm_per_source = read_setting_u();
+		else if (strcmp(name, "jumbo_peek") == 0)
+			jumbo_peek = read_setting_u();
 		else if (strcmp(name, "allowed_tcp_ports") == 0)
 			while (is_reading_setting_value())
 				add_in_plist(tcp_port, htons(read_setting_u()));
 		else if (strcmp(name, "allowed_udp_ports") == 0)
 			while (is_reading_setting_value())
 				add_in_plist(udp_port, htons(read_setting_u()));
+		else if (strcmp(name, "include_protocols") == 0)
+			while (is_reading_setting_value())
+				add_in_filter_list(&filter.include_protocols, read_setting_u());
+		else if (strcmp(name, "exclude_protocols") == 0)
+			while (is_reading_setting_value())
+				add_in_filter_list(&filter.exclude_protocols, read_setting_u());
+		else if (strcmp(name, "include_hosts") == 0)
+			while (is_reading_setting_value())
+				add_in_filter_list(&filter.include_hosts,
+					ntohl(inet_addr(read_setting_s())));
+		else if (strcmp(name, "exclude_hosts") == 0)
+			while (is_reading_setting_value())
+				add_in_filter_list(&filter.exclude_hosts,
+					ntohl(inet_addr(read_setting_s())));
+		else if (strcmp(name, "filter_ports") == 0)
+			filter.filter_ports = read_setting_u() != 0;
+		else if (strcmp(name, "filter_dump") == 0)
+			filter.dump = read_setting_u();
 		else
 			print_not_used(name);
 	}
 
+	// Режимы захвата сопоставляются адаптерам по порядку
+	AdapterList *al = beg_alist;
+	PNode *mode = modes->beg;
+	while (al != NULL && mode != NULL)
+	{
+		al->mode = mode->value;
+		al = al->next;
+		mode = mode->next;
+	}
+	// Веса для деления очередей при перегрузке - тоже по порядку
+	al = beg_alist;
+	PNode *weight = weights->beg;
+	while (al != NULL && weight != NULL)
+	{
+		if (weight->value > 0)
+			al->data.weight = weight->value;
+		al = al->next;
+		weight = weight->next;
+	}
+
+	// Фильтр применяется до передачи пакетов анализаторам
+	FilterProgram *fp = compile_filter(&filter, tcp_port, udp_port);
+	dump_filter(fp, filter.dump);
+	set_capture_filter(fp);
+	// Копии пакета, принятые несколькими адаптерами, анализируются один раз
+	init_dedup(dedup_table_size, dedup_window, dedup_bytes);
+	// Фрагменты передаются анализаторам одной собранной датаграммой
+	init_reasm(reasm_memory, reasm_timeout, reasm_per_source);
+	
+	// Анализаторы размещаются рядом с приёмом адаптеров
+	uint32_t adapter_count = 0;
+	for (al = beg_alist; al != NULL; al = al->next)
+		adapter_count++;
+	set_thread_groups(adapter_count);
+	
 	// Инициализация анализаторов
 	run_analyzer(tcp_port, udp_port);
+	
+	// Подключение к адаптерам после готовности анализаторов
+	uint32_t index = 0;
+	for (al = beg_alist; al != NULL; al = al->next)
+		connection_to_adapter(al, index++);
+	run_capture_mux();
+	
+	// Воспроизведение сохранённого трафика
+	run_replay();
 }
 
-void connection_to_adapter(const char *addr)
+void add_adapter(const char *addr)
 {
-	// Создание отдельного потока
 	AdapterList *alist = (AdapterList *)malloc(sizeof(AdapterList));
 	alist->data.addr = addr;
 	alist->data.fid = add_log_file(addr);
-	alist->hThread	= CreateThread(NULL, 0, sn_thread, &alist->data, 0, NULL);
-	if (alist->hThread == NULL)
-		print_errlog("Failed to create thread!\n");
+	register_adapter(&alist->data);
+	alist->mode = CMODE_RECV;
+	alist->hThread = NULL;
+	alist->s = INVALID_SOCKET;
+	alist->frames = NULL;
 	alist->next = NULL;
 	// Добавление его в список
 	if (beg_alist == NULL)
@@ -72,13 +295,53 @@ void connection_to_adapter(const char *addr)
 	end_alist = alist;
 }
 
-DWORD WINAPI sn_thread(LPVOID ptr)
+void connection_to_adapter(AdapterList *al, uint32_t index)
+{
+	// Адаптер без собственного потока
+	if (al->mode == CMODE_MUX)
+	{
+		add_mux_adapter(al);
+		return;
+	}
+	// Пакеты адаптера распределяются прежде всего анализаторам рядом с его
+	// потоком приёма
+	al->data.group = get_thread_group(index);
+	// Создание отдельного потока
+	if (al->mode == CMODE_RING)
+		al->hThread = CreateThread(NULL, 0, sn_ring_thread, &al->data, 0, NULL);
+	else if (al->mode == CMODE_BATCH)
+		al->hThread = CreateThread(NULL, 0, sn_batch_thread, &al->data, 0, NULL);
+	else if (al->mode == CMODE_UMEM)
+		al->hThread = CreateThread(NULL, 0, sn_umem_thread, &al->data, 0, NULL);
+	else
+		al->hThread = CreateThread(NULL, 0, sn_thread, &al->data, 0, NULL);
+	if (al->hThread == NULL)
+		print_errlog("Failed to create thread!\n");
+	place_thread(al->hThread, TCLASS_SNIFFER, index, al->data.addr);
+}
+
+uint8_t get_capture_mode(const char *name)
+{
+	uint8_t mode = CMODE_RECV;
+	if (strcmp(name, "ring") == 0)
+		mode = CMODE_RING;
+	else if (strcmp(name, "batch") == 0)
+		mode = CMODE_BATCH;
+	else if (strcmp(name, "umem") == 0)
+		mode = CMODE_UMEM;
+	else if (strcmp(name, "mux") == 0)
+		mode = CMODE_MUX;
+	else if (strcmp(name, "recv") != 0)
+		print_errlogf("Unknown capture mode \"%s\", recv is used", name);
+	return mode;
+}
+
+SOCKET open_adapter_socket(AdapterData *data, DWORD flags)
 {
-	AdapterData *data = (AdapterData *)ptr;
 	// Создание сокета
-	SOCKET s = socket(AF_INET, SOCK_RAW, IPPROTO_IP);
+	SOCKET s = WSASocket(AF_INET, SOCK_RAW, IPPROTO_IP, NULL, 0, flags);
 	if (s == INVALID_SOCKET) {
-		print_errlogf("Error creating socket: %s\n", WSAGetLastError());
+		print_errlogf("Error creating socket: %d\n", WSAGetLastError());
 		WSACleanup();
 		exit(5);
 	}
@@ -92,15 +355,347 @@ DWORD WINAPI sn_thread(LPVOID ptr)
 	// Включение режима promiscuous
 	unsigned long flag = TRUE;
 	ioctlsocket(s, SIO_RCVALL, &flag);
-	
+	return s;
+}
+
+DWORD WINAPI sn_thread(LPVOID ptr)
+{
+	AdapterData *data = (AdapterData *)ptr;
+	SOCKET s = open_adapter_socket(data, 0);
+	PackageSlot slot;
+	init_slot(&slot, data);
 	print_msglogf("Listening on adapter with address %s.\n", data->addr);
 	// Просмотр всех пакетов
 	while (TRUE)
 	{
-		int count = recv(s, data->buffer, PACKAGE_BUFFER_SIZE, 0);
-		if (count >= sizeof(IPHeader))
+		// Приём идет сразу в слот пула, который получит анализатор; место
+		// в очереди занимается только после приёма, чтобы анализатор не
+		// оставался занятым на время ожидания пакета
+		int count = receive_slot(s, &slot);
+		if (count > 0 && is_package_accepted(get_slot_buffer(&slot), count))
+		{
+			// Фрагменты накапливаются до сборки всей датаграммы
+			count = assemble_slot(&slot, count);
+			if (count > 0)
+			{
+				reserve_slot(&slot, 1);
+				fill_slot(&slot, data, count);
+				publish_slot(&slot);
+			}
+		}
+	}
+}
+
+int receive_slot(SOCKET s, PackageSlot *slot)
+{
+	if (jumbo_peek)
+	{
+		// Размер пакета узнается без извлечения его из сокета, так как
+		// извлеченный не целиком пакет теряет остаток; это второй вызов
+		// на каждый пакет
+		int count = recv(s, get_slot_buffer(slot), get_slot_length(slot),
+			MSG_PEEK);
+		if (count == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE &&
+			!grow_slot(slot))
+		{
+			// Слотов больших пакетов нет: пакет извлекается и отбрасывается
+			recv(s, get_slot_buffer(slot), get_slot_length(slot), 0);
+			return 0;
+		}
+	}
+	int count = recv(s, get_slot_buffer(slot), get_slot_length(slot), 0);
+	if (count == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE)
+	{
+		// Пакет больше слота уже извлечен без остатка
+		drop_slot(slot);
+		return 0;
+	}
+	return count;
+}
+
+CaptureRing *create_capture_ring(AdapterData *data)
+{
+	CaptureRing *ring = (CaptureRing *)malloc(sizeof(CaptureRing));
+	uint32_t frame_size = ring_block_size / ring_frame_count;
+	if (frame_size < PACKAGE_BUFFER_SIZE)
+		print_msglogf("Ring frames of %u bytes may truncate large packets.\n",
+			frame_size);
+	ring->frame_count = ring_frame_count * ring_block_count;
+	ring->memory = (char *)malloc((size_t)ring_block_size * ring_block_count);
+	ring->frames = (RingFrame *)malloc(ring->frame_count * sizeof(RingFrame));
+	ring->entries = (OVERLAPPED_ENTRY *)malloc(ring_frame_count *
+		sizeof(OVERLAPPED_ENTRY));
+	ring->batch.buffers = (const char **)malloc(ring_frame_count *
+		sizeof(char *));
+	ring->batch.sizes = (uint32_t *)malloc(ring_frame_count * sizeof(uint32_t));
+	ring->s = open_adapter_socket(data, WSA_FLAG_OVERLAPPED);
+	ring->port = open_completion_port(ring->s, data);
+	// Разметка блоков на кадры и запуск приёма во все кадры
+	for (uint32_t i = 0; i < ring->frame_count; i++)
+	{
+		RingFrame *frame = ring->frames + i;
+		frame->wsabuf.buf = ring->memory + (size_t)i * frame_size;
+		frame->wsabuf.len = frame_size;
+		post_ring_frame(ring->s, frame);
+	}
+	return ring;
+}
+
+HANDLE open_completion_port(SOCKET s, AdapterData *data)
+{
+	HANDLE port = CreateIoCompletionPort((HANDLE)s, NULL, (ULONG_PTR)data, 1);
+	if (port == NULL)
+	{
+		print_errlogf("Failed to create completion port: %u\n",
+			GetLastError());
+		exit(9);
+	}
+	return port;
+}
+
+void post_ring_frame(SOCKET s, RingFrame *frame)
+{
+	ZeroMemory(&frame->ov, sizeof(WSAOVERLAPPED));
+	frame->flags = 0;
+	if (WSARecv(s, &frame->wsabuf, 1, NULL, &frame->flags,
+		&frame->ov, NULL) == SOCKET_ERROR)
+	{
+		int error = WSAGetLastError();
+		if (error != WSA_IO_PENDING)
+			print_errlogf("Failed to post ring frame: %d\n", error);
+	}
+}
+
+DWORD WINAPI sn_ring_thread(LPVOID ptr)
+{
+	AdapterData *data = (AdapterData *)ptr;
+	CaptureRing *ring = create_capture_ring(data);
+	print_msglogf("Listening on adapter with address %s (ring: %u x %u).\n",
+		data->addr, ring_block_count, ring_frame_count);
+	while (TRUE)
+	{
+		// Получение блока завершённых кадров за один системный вызов
+		ULONG count = 0;
+		if (!GetQueuedCompletionStatusEx(ring->port, ring->entries,
+			ring_frame_count, &count, ring_timeout, FALSE))
+			continue;
+		// Передача всех кадров блока на анализ одним вызовом
+		ring->batch.count = 0;
+		for (ULONG i = 0; i < count; i++)
+		{
+			RingFrame *frame = (RingFrame *)ring->entries[i].lpOverlapped;
+			DWORD size = ring->entries[i].dwNumberOfBytesTransferred;
+			if (is_package_accepted(frame->wsabuf.buf, size) &&
+				assemble_package(data, frame->wsabuf.buf, size))
+			{
+				ring->batch.buffers[ring->batch.count] = frame->wsabuf.buf;
+				ring->batch.sizes[ring->batch.count] = size;
+				ring->batch.count++;
+			}
+		}
+		if (ring->batch.count > 0)
+			analyze_packages(data, &ring->batch);
+		// Возврат кадров в кольцо: Winsock принимает в кадр только по
+		// отдельному WSARecv, поэтому на каждый пакет остается один вызов
+		for (ULONG i = 0; i < count; i++)
+			post_ring_frame(ring->s, (RingFrame *)ring->entries[i].lpOverlapped);
+	}
+}
+
+DWORD WINAPI sn_batch_thread(LPVOID ptr)
+{
+	AdapterData *data = (AdapterData *)ptr;
+	SOCKET s = open_adapter_socket(data, 0);
+	// Неблокирующий режим, чтобы выбирать пакеты до опустошения очереди
+	unsigned long flag = TRUE;
+	ioctlsocket(s, FIONBIO, &flag);
+	PackageSlot slot;
+	init_slot(&slot, data);
+	struct timeval tv;
+	tv.tv_sec = batch_timeout / 1000;
+	tv.tv_usec = (batch_timeout % 1000) * 1000;
+	print_msglogf("Listening on adapter with address %s (batch: %u).\n",
+		data->addr, batch_size);
+	while (TRUE)
+	{
+		// Ожидание первого пакета выборки
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(s, &fds);
+		if (select(0, &fds, NULL, NULL, &tv) <= 0)
+			continue;
+		// Выборка пакетов, уже находящихся в очереди сокета,
+		// сразу в слоты пула
+		reserve_slot(&slot, batch_size);
+		uint32_t received = 0;
+		while (received < batch_size && is_slot_available(&slot))
+		{
+			int count = receive_slot(s, &slot);
+			if (count == SOCKET_ERROR)
+				break;
+			if (count > 0 &&
+				is_package_accepted(get_slot_buffer(&slot), count))
+			{
+				count = assemble_slot(&slot, count);
+				if (count > 0)
+					fill_slot(&slot, data, count);
+			}
+			received++;
+		}
+		publish_slot(&slot);
+	}
+}
+
+UmemCapture *create_umem_capture(AdapterData *data)
+{
+	UmemCapture *uc = (UmemCapture *)malloc(sizeof(UmemCapture));
+	uc->umem = create_umem(umem_frame_count, umem_frame_size);
+	uc->frames = (RingFrame *)malloc(umem_frame_count * sizeof(RingFrame));
+	uc->entries = (OVERLAPPED_ENTRY *)malloc(ring_frame_count *
+		sizeof(OVERLAPPED_ENTRY));
+	uc->received = (UmemFrame **)malloc(ring_frame_count * sizeof(UmemFrame *));
+	uc->sizes = (uint32_t *)malloc(ring_frame_count * sizeof(uint32_t));
+	// Состояние приёма привязано к кадру по его номеру
+	for (uint32_t i = 0; i < umem_frame_count; i++)
+	{
+		uc->frames[i].wsabuf.buf = uc->umem->frames[i].data;
+		uc->frames[i].wsabuf.len = umem_frame_size;
+	}
+	uc->s = open_adapter_socket(data, WSA_FLAG_OVERLAPPED);
+	uc->port = open_completion_port(uc->s, data);
+	return uc;
+}
+
+DWORD WINAPI sn_umem_thread(LPVOID ptr)
+{
+	AdapterData *data = (AdapterData *)ptr;
+	UmemCapture *uc = create_umem_capture(data);
+	print_msglogf("Listening on adapter with address %s (umem: %u x %u).\n",
+		data->addr, umem_frame_count, umem_frame_size);
+	while (TRUE)
+	{
+		// Приём во все кадры, возвращённые анализаторами
+		UmemFrame *frame;
+		while (pop_fill_ring(uc->umem, &frame))
+			post_ring_frame(uc->s, &uc->frames[frame->index]);
+		// Получение завершённых кадров за один системный вызов
+		ULONG count = 0;
+		if (!GetQueuedCompletionStatusEx(uc->port, uc->entries,
+			ring_frame_count, &count, ring_timeout, FALSE))
+			continue;
+		uint32_t received = 0;
+		for (ULONG i = 0; i < count; i++)
+		{
+			RingFrame *rf = (RingFrame *)uc->entries[i].lpOverlapped;
+			DWORD size = uc->entries[i].dwNumberOfBytesTransferred;
+			frame = &uc->umem->frames[rf - uc->frames];
+			if (is_package_accepted(frame->data, size) &&
+				assemble_package(data, frame->data, size))
+			{
+				uc->received[received] = frame;
+				uc->sizes[received] = size;
+				received++;
+			}
+			else
+				release_umem_frame(frame);
+		}
+		// Анализаторы читают пакеты прямо из кадров
+		if (received > 0)
+			analyze_frames(data, uc->received, uc->sizes, received);
+	}
+}
+
+void add_mux_adapter(AdapterList *al)
+{
+	al->s = open_adapter_socket(&al->data, WSA_FLAG_OVERLAPPED);
+	// Ключ завершения указывает на адаптер, от которого принят пакет
+	mux_port = CreateIoCompletionPort((HANDLE)al->s, mux_port, (ULONG_PTR)al,
+		mux_threads);
+	if (mux_port == NULL)
+	{
+		print_errlogf("Failed to create completion port: %u\n",
+			GetLastError());
+		exit(9);
+	}
+	al->frames = (RingFrame *)malloc(mux_frame_count * sizeof(RingFrame));
+	char *memory = (char *)malloc((size_t)mux_frame_count * mux_frame_size);
+	for (uint32_t i = 0; i < mux_frame_count; i++)
+	{
+		al->frames[i].wsabuf.buf = memory + (size_t)i * mux_frame_size;
+		al->frames[i].wsabuf.len = mux_frame_size;
+		post_ring_frame(al->s, al->frames + i);
+	}
+	mux_adapter_count++;
+	print_msglogf("Listening on adapter with address %s (mux).\n",
+		al->data.addr);
+}
+
+void run_capture_mux()
+{
+	if (mux_port == NULL)
+		return;
+	// Количество потоков зависит от числа ядер, а не адаптеров
+	uint32_t count = mux_threads;
+	if (count == 0)
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		count = si.dwNumberOfProcessors;
+	}
+	if (count > mux_adapter_count)
+		count = mux_adapter_count;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		HANDLE hThread = CreateThread(NULL, 0, sn_mux_thread, NULL, 0, NULL);
+		if (hThread == NULL)
+			print_errlog("Failed to create thread!\n");
+		char name[32];
+		snprintf(name, sizeof(name), "Capture thread #%u", i + 1);
+		place_thread(hThread, TCLASS_SNIFFER, i, name);
+	}
+	print_msglogf("%u capture threads serve %u adapters.\n", count,
+		mux_adapter_count);
+}
+
+DWORD WINAPI sn_mux_thread(LPVOID ptr)
+{
+	OVERLAPPED_ENTRY *entries = (OVERLAPPED_ENTRY *)malloc(ring_frame_count *
+		sizeof(OVERLAPPED_ENTRY));
+	PackageBatch batch;
+	batch.buffers = (const char **)malloc(ring_frame_count * sizeof(char *));
+	batch.sizes = (uint32_t *)malloc(ring_frame_count * sizeof(uint32_t));
+	while (TRUE)
+	{
+		// Завершённые кадры всех адаптеров за один системный вызов
+		ULONG count = 0;
+		if (!GetQueuedCompletionStatusEx(mux_port, entries, ring_frame_count,
+			&count, ring_timeout, FALSE))
+			continue;
+		// Подряд идущие кадры одного адаптера передаются одной выборкой
+		ULONG beg = 0;
+		while (beg < count)
 		{
-			analyze_package(data);
+			AdapterList *al = (AdapterList *)entries[beg].lpCompletionKey;
+			ULONG end = beg;
+			batch.count = 0;
+			for (; end < count && entries[end].lpCompletionKey ==
+				(ULONG_PTR)al; end++)
+			{
+				RingFrame *frame = (RingFrame *)entries[end].lpOverlapped;
+				DWORD size = entries[end].dwNumberOfBytesTransferred;
+				if (is_package_accepted(frame->wsabuf.buf, size) &&
+					assemble_package(&al->data, frame->wsabuf.buf, size))
+				{
+					batch.buffers[batch.count] = frame->wsabuf.buf;
+					batch.sizes[batch.count] = size;
+					batch.count++;
+				}
+			}
+			if (batch.count > 0)
+				analyze_packages(&al->data, &batch);
+			// Возврат кадров на приём
+			for (; beg < end; beg++)
+				post_ring_frame(al->s, (RingFrame *)entries[beg].lpOverlapped);
 		}
 	}
 }
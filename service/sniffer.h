@@ -9,18 +9,63 @@
 #ifndef __SNIFFER_H__
 #define __SNIFFER_H__
 
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600 // Для GetQueuedCompletionStatusEx
+#endif
+
 #include <winsock2.h>
 
-#include "analyzer.h"
+#include "replay.h"
 
 #define SIO_RCVALL 0x98000001 // Для приёма всех пакетов из сети
 #define HOST_NAME_SIZE    128 // Размер имени хоста
+// Режим захвата пакетов адаптера
+#define CMODE_RECV 0x00  // Один вызов recv на каждый пакет
+#define CMODE_RING 0x01  // Кольцо блоков с асинхронным приёмом
+#define CMODE_BATCH 0x02 // Выборка нескольких пакетов за одно пробуждение
+#define CMODE_UMEM 0x03  // Приём в кадры UMEM, анализируемые без копирования
+#define CMODE_MUX  0x04  // Общие потоки приёма для многих адаптеров
+
+// Кадр кольца захвата (место под один пакет)
+typedef struct RingFrame
+{
+	WSAOVERLAPPED ov;  // Состояние асинхронного приёма (должно быть первым)
+	WSABUF wsabuf;     // Описание памяти кадра
+	DWORD flags;       // Флаги приёма
+} RingFrame;
+
+// Кольцо блоков захвата
+typedef struct CaptureRing
+{
+	SOCKET s;                  // Сокет адаптера
+	HANDLE port;               // Порт завершения для приёма блоков
+	char *memory;              // Память всех блоков кольца
+	RingFrame *frames;         // Кадры всех блоков
+	OVERLAPPED_ENTRY *entries; // Завершённые кадры одного блока
+	PackageBatch batch;        // Пакеты блока для передачи анализаторам
+	uint32_t frame_count;      // Общее количество кадров
+} CaptureRing;
+
+// Приём в кадры общей памяти (UMEM), возвращаемые анализаторами
+typedef struct UmemCapture
+{
+	SOCKET s;                  // Сокет адаптера
+	HANDLE port;               // Порт завершения для приёма кадров
+	UmemPool *umem;            // Кадры и кольцо свободных кадров
+	RingFrame *frames;         // Состояние асинхронного приёма каждого кадра
+	OVERLAPPED_ENTRY *entries; // Завершённые кадры за одно пробуждение
+	UmemFrame **received;      // Принятые кадры для передачи анализаторам
+	uint32_t *sizes;           // Количество принятых байт каждого кадра
+} UmemCapture;
 
 // Список сведений для адаптера
 typedef struct AdapterList
 {
 	AdapterData data;         // Данные для адаптера
+	uint8_t mode;             // Режим захвата пакетов
 	HANDLE hThread;           // Ссылка на поток
+	SOCKET s;                 // Сокет адаптера (режим mux)
+	RingFrame *frames;        // Кадры асинхронного приёма (режим mux)
 	struct AdapterList *next; // Следующий адаптер
 } AdapterList;
 
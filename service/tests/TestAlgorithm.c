@@ -287,6 +287,33 @@ void test_CheckPackage_AnomalyDetection()
 	TEST_ASSERT_EQUAL_STRING_LEN("01234", pa->detector, det_db->size);
 }
 
+// Проверка поиска аномалии на стыке двух сегментов потока
+void test_CheckJoint_AnomalyAcrossSegments()
+{
+	reset_memory(det_db);
+	add_to_memory(det_db, "defgh");
+	char tail[8] = "abcd";
+	char joint[16];
+	// В каждом сегменте по отдельности аномалии нет
+	TEST_ASSERT_NULL(check_package(tail, 4));
+	TEST_ASSERT_NULL(check_package("efgh", 4));
+	// Окно "defgh" пересекает стык
+	memcpy(joint, tail, 4);
+	uint32_t len = make_joint(joint, 4, "efgh", 4);
+	TEST_ASSERT_EQUAL_UINT32(8, len);
+	PackAnomaly *pa = check_joint(joint, len, 4);
+	TEST_ASSERT_NOT_NULL(pa);
+	TEST_ASSERT_EQUAL_STRING_LEN("defgh", pa->pattern, det_db->size);
+	free(pa);
+	// Сохраняются только последние pat_length-1 байт потока
+	TEST_ASSERT_EQUAL_UINT8(4, update_tail(tail, 4, "ef", 2));
+	TEST_ASSERT_EQUAL_STRING_LEN("cdef", tail, 4);
+	TEST_ASSERT_EQUAL_UINT8(4, update_tail(tail, 4, "123456", 6));
+	TEST_ASSERT_EQUAL_STRING_LEN("3456", tail, 4);
+	TEST_ASSERT_EQUAL_UINT8(2, update_tail(tail, 0, "xy", 2));
+	TEST_ASSERT_EQUAL_STRING_LEN("xy", tail, 2);
+}
+
 // Проверка поиска аномалии статистики вне пространства дерева
 void test_CheckStatistics_AnomalyDetectionOutSpace()
 {
@@ -408,6 +435,7 @@ int main()
 	RUN_TEST(test_CompressKDTree_CorrectStructure);
 	RUN_TEST(test_PackAndUnpackDetectors_DataIntegrity);
 	RUN_TEST(test_CheckPackage_AnomalyDetection);
+	RUN_TEST(test_CheckJoint_AnomalyAcrossSegments);
 	RUN_TEST(test_CheckStatistics_AnomalyDetectionOutSpace);
 	RUN_TEST(test_CheckStatistics_AnomalyDetectionInSpace);
 	return UNITY_END();
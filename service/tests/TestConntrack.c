@@ -0,0 +1,213 @@
+/******************************************************************************
+     * File: TestConntrack.c
+     * Description: Тестирование таблицы TCP-соединений и колеса таймеров
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "src\\unity.h"
+#include "..\\conntrack.h"
+
+#define TEST_FIN 0x01 // Флаг FIN
+#define TEST_SYN 0x02 // Флаг SYN
+#define TEST_RST 0x04 // Флаг RST
+#define TEST_ACK 0x10 // Флаг ACK
+
+#define TEST_CLIENT 0x0A000001 // Адрес инициатора
+#define TEST_SERVER 0x0A000002 // Адрес ответчика
+
+extern ConnStripe *conn_stripes;
+extern uint32_t conn_stripe_size;
+
+void advance_conn_wheel(ConnStripe *st, uint32_t tick);
+
+/**
+@brief Передает сегмент соединения инициатора и ответчика
+@param dir Направление сегмента (0 - от инициатора)
+@param flags Флаги TCP
+@param events Для записи событий соединения
+@return Номер соединения, умноженный на 2, плюс направление сегмента
+*/
+uint32_t send_segment(uint8_t dir, uint8_t flags, uint8_t *events)
+{
+	ConnStripe *locked = NULL;
+	uint32_t conn;
+	if (dir == 0)
+		conn = track_connection(TEST_CLIENT, TEST_SERVER, 40000, 80, flags,
+			&locked, events);
+	else
+		conn = track_connection(TEST_SERVER, TEST_CLIENT, 80, 40000, flags,
+			&locked, events);
+	release_conn_stripe(locked);
+	return conn;
+}
+
+/**
+@brief Получает часть таблицы, в которой находится соединение
+@param conn Номер соединения от track_connection
+@return Часть таблицы
+*/
+ConnStripe *get_test_stripe(uint32_t conn)
+{
+	return &conn_stripes[(conn >> 1) / conn_stripe_size];
+}
+
+/**
+@brief Получает запись о соединении
+@param conn Номер соединения от track_connection
+@return Запись о соединении
+*/
+ConnEntry *get_test_entry(uint32_t conn)
+{
+	return &get_test_stripe(conn)->entries[(conn >> 1) % conn_stripe_size];
+}
+
+// Проверка перехода соединения в открытое состояние при тройном рукопожатии
+void test_TrackConnection_HandshakeEstablished()
+{
+	uint8_t events;
+	uint32_t conn = send_segment(0, TEST_SYN, &events);
+	TEST_ASSERT_NOT_EQUAL(CONN_NONE, conn);
+	TEST_ASSERT_EQUAL_UINT32(0, conn & 1);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_OPENED, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_SYN_SENT, get_test_entry(conn)->state);
+	// Ответ попадает в ту же запись с обратным направлением
+	uint32_t reply = send_segment(1, TEST_SYN | TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT32(conn | 1, reply);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_NONE, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_SYN_RECV, get_test_entry(conn)->state);
+	send_segment(0, TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_ESTABLISHED, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_ESTABLISHED, get_test_entry(conn)->state);
+}
+
+// Проверка закрытия соединения после FIN обеих сторон
+void test_TrackConnection_FinCloses()
+{
+	uint8_t events;
+	// Соединение, открытое до начала захвата, считается открытым
+	uint32_t conn = send_segment(0, TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_NONE, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_ESTABLISHED, get_test_entry(conn)->state);
+	send_segment(0, TEST_FIN | TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_CLOSED, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_CLOSING, get_test_entry(conn)->state);
+	// Закрытие учитывается один раз
+	send_segment(1, TEST_FIN | TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_NONE, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_CLOSED, get_test_entry(conn)->state);
+}
+
+// Проверка сброса известного и неизвестного соединения
+void test_TrackConnection_ResetCloses()
+{
+	uint8_t events;
+	// Сброс неизвестного соединения не занимает запись
+	TEST_ASSERT_EQUAL_UINT32(CONN_NONE, send_segment(0, TEST_RST, &events));
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_RESET, events);
+	uint32_t conn = send_segment(0, TEST_SYN, &events);
+	send_segment(1, TEST_RST | TEST_ACK, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_RESET, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_CLOSED, get_test_entry(conn)->state);
+	// Повторный сброс закрытого соединения не учитывается
+	send_segment(0, TEST_RST, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_NONE, events);
+	// Новый SYN открывает соединение заново
+	send_segment(0, TEST_SYN, &events);
+	TEST_ASSERT_EQUAL_UINT8(CEVENT_OPENED, events);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_SYN_SENT, get_test_entry(conn)->state);
+}
+
+// Проверка удаления соединения ближним уровнем колеса
+void test_AdvanceConnWheel_ExpireNear()
+{
+	uint8_t events;
+	uint32_t conn = send_segment(0, TEST_SYN, &events);
+	ConnStripe *st = get_test_stripe(conn);
+	ConnEntry *ce = get_test_entry(conn);
+	TEST_ASSERT_TRUE(ce->slot < CONN_WHEEL_SIZE);
+	advance_conn_wheel(st, ce->expire - 1);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_SYN_SENT, ce->state);
+	TEST_ASSERT_EQUAL_UINT32(1, st->active);
+	advance_conn_wheel(st, ce->expire);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_FREE, ce->state);
+	TEST_ASSERT_EQUAL_UINT32(0, st->active);
+	TEST_ASSERT_EQUAL_UINT32(1, st->expired);
+}
+
+// Проверка переноса соединения с дальнего уровня колеса на ближний
+void test_AdvanceConnWheel_CascadeOuter()
+{
+	uint8_t events;
+	uint32_t conn = send_segment(0, TEST_ACK, &events);
+	ConnStripe *st = get_test_stripe(conn);
+	ConnEntry *ce = get_test_entry(conn);
+	// Колесо переводится на 8 тактов от начала оборота ближнего уровня,
+	// чтобы время истечения не совпало с переносом (закрытая запись
+	// удаляется за это время)
+	send_segment(0, TEST_RST, &events);
+	advance_conn_wheel(st, (st->tick | (CONN_WHEEL_SIZE - 1)) + 9);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_FREE, ce->state);
+	conn = send_segment(0, TEST_ACK, &events);
+	ce = get_test_entry(conn);
+	uint32_t expire = ce->expire;
+	TEST_ASSERT_TRUE(ce->slot >= CONN_WHEEL_SIZE);
+	// После прохода ближнего уровня запись переходит на него
+	advance_conn_wheel(st, expire & ~(CONN_WHEEL_SIZE - 1));
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_ESTABLISHED, ce->state);
+	TEST_ASSERT_EQUAL_UINT16(expire & (CONN_WHEEL_SIZE - 1), ce->slot);
+	advance_conn_wheel(st, expire - 1);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_ESTABLISHED, ce->state);
+	advance_conn_wheel(st, expire);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_FREE, ce->state);
+	TEST_ASSERT_EQUAL_UINT32(0, st->active);
+}
+
+// Проверка, что продленное соединение не удаляется по старому времени
+void test_AdvanceConnWheel_ExtendedKept()
+{
+	uint8_t events;
+	uint32_t conn = send_segment(0, TEST_ACK, &events);
+	ConnStripe *st = get_test_stripe(conn);
+	ConnEntry *ce = get_test_entry(conn);
+	uint32_t expire = ce->expire;
+	// Сегмент в том же состоянии продлевает время без перестановки записи
+	advance_conn_wheel(st, st->tick + 10);
+	send_segment(1, TEST_ACK, &events);
+	TEST_ASSERT_TRUE((int32_t)(ce->expire - expire) > 0);
+	advance_conn_wheel(st, expire);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_ESTABLISHED, ce->state);
+	advance_conn_wheel(st, ce->expire);
+	TEST_ASSERT_EQUAL_UINT8(CSTATE_FREE, ce->state);
+}
+
+void setUp()
+{
+	// Такт 10 мс: открытие - 5 тактов, открытое соединение - 500 тактов
+	// (дальний уровень колеса), закрытое - 2 такта
+	init_conntrack(1024, 10, 50, 5000, 20);
+}
+
+void tearDown()
+{
+	for (int i = 0; i < CONN_STRIPE_COUNT; i++)
+	{
+		DeleteCriticalSection(&conn_stripes[i].lock);
+		free(conn_stripes[i].entries);
+	}
+	free(conn_stripes);
+	conn_stripes = NULL;
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_TrackConnection_HandshakeEstablished);
+	RUN_TEST(test_TrackConnection_FinCloses);
+	RUN_TEST(test_TrackConnection_ResetCloses);
+	RUN_TEST(test_AdvanceConnWheel_ExpireNear);
+	RUN_TEST(test_AdvanceConnWheel_CascadeOuter);
+	RUN_TEST(test_AdvanceConnWheel_ExtendedKept);
+	return UNITY_END();
+}
@@ -0,0 +1,221 @@
+/******************************************************************************
+     * File: TestFilter.c
+     * Description: Тестирование построения и выполнения фильтра захвата
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "src\\unity.h"
+#include "..\\filter.h"
+
+#define TEST_HEADER_LEN 20 // Длина IP-заголовка пакетов
+
+#define TEST_CLIENT 0x0A000001 // Адрес клиента
+#define TEST_SERVER 0x0A000002 // Адрес сервера
+#define TEST_OTHER  0x0A000003 // Адрес постороннего узла
+
+FilterConfig fc;          // Условия фильтра тестов
+PList *tcp_ports = NULL;  // Разрешенные порты TCP
+PList *udp_ports = NULL;  // Разрешенные порты UDP
+FilterProgram *fp = NULL; // Построенная программа
+uint8_t package[TEST_HEADER_LEN + 4]; // Пакет тестов
+
+/**
+@brief Формирует пакет с IP-заголовком и портами транспортного уровня
+@param protocol Протокол
+@param src Адрес отправителя
+@param dst Адрес получателя
+@param sport Порт отправителя
+@param dport Порт получателя
+@return Длина пакета
+*/
+uint32_t make_package(uint8_t protocol, uint32_t src, uint32_t dst,
+	uint16_t sport, uint16_t dport)
+{
+	memset(package, 0, sizeof(package));
+	package[0] = 0x45;
+	package[9] = protocol;
+	for (int i = 0; i < 4; i++)
+	{
+		package[12 + i] = src >> (24 - 8 * i);
+		package[16 + i] = dst >> (24 - 8 * i);
+	}
+	package[TEST_HEADER_LEN] = sport >> 8;
+	package[TEST_HEADER_LEN + 1] = sport & 0xFF;
+	package[TEST_HEADER_LEN + 2] = dport >> 8;
+	package[TEST_HEADER_LEN + 3] = dport & 0xFF;
+	return sizeof(package);
+}
+
+/**
+@brief Строит программу по условиям тестов и проверяет ею пакет
+@param protocol Протокол
+@param src Адрес отправителя
+@param dst Адрес получателя
+@param sport Порт отправителя
+@param dport Порт получателя
+@return TRUE - пакет пропущен
+*/
+Bool is_passed(uint8_t protocol, uint32_t src, uint32_t dst,
+	uint16_t sport, uint16_t dport)
+{
+	if (fp == NULL)
+		fp = compile_filter(&fc, tcp_ports, udp_ports);
+	TEST_ASSERT_NOT_NULL(fp);
+	uint32_t len = make_package(protocol, src, dst, sport, dport);
+	return run_filter(fp, package, len) != 0;
+}
+
+/**
+@brief Освобождает список портов
+@param pl Список
+*/
+void free_plist(PList *pl)
+{
+	PNode *p = pl->beg;
+	while (p != NULL)
+	{
+		PNode *next = p->next;
+		free(p);
+		p = next;
+	}
+	CloseHandle(pl->mutex);
+	free(pl);
+}
+
+// Проверка, что без условий программа не строится
+void test_CompileFilter_EmptyConfig()
+{
+	TEST_ASSERT_NULL(compile_filter(&fc, tcp_ports, udp_ports));
+}
+
+// Проверка отбрасывания пакетов исключенного узла в обоих направлениях
+void test_RunFilter_ExcludeHosts()
+{
+	add_in_filter_list(&fc.exclude_hosts, TEST_OTHER);
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER, 1, 2));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_TCP, TEST_OTHER, TEST_SERVER, 1, 2));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_UDP, TEST_CLIENT, TEST_OTHER, 1, 2));
+}
+
+// Проверка пропуска только пакетов указанных узлов
+void test_RunFilter_IncludeHosts()
+{
+	add_in_filter_list(&fc.include_hosts, TEST_SERVER);
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER, 1, 2));
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_SERVER, TEST_CLIENT, 2, 1));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_OTHER, 1, 2));
+}
+
+// Проверка отбора по протоколу
+void test_RunFilter_Protocols()
+{
+	add_in_filter_list(&fc.include_protocols, IPPROTO_TCP);
+	add_in_filter_list(&fc.include_protocols, IPPROTO_UDP);
+	add_in_filter_list(&fc.exclude_protocols, IPPROTO_UDP);
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER, 1, 2));
+	// Исключение проверяется раньше пропуска
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_UDP, TEST_CLIENT, TEST_SERVER, 1, 2));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_ICMP, TEST_CLIENT, TEST_SERVER, 0, 0));
+}
+
+// Проверка портов TCP и UDP в запросе и в ответе
+void test_RunFilter_PortsBothDirections()
+{
+	fc.filter_ports = TRUE;
+	add_in_plist(tcp_ports, htons(80));
+	add_in_plist(udp_ports, htons(53));
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER,
+		40000, 80));
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_SERVER, TEST_CLIENT,
+		80, 40000));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER,
+		40000, 53));
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_UDP, TEST_SERVER, TEST_CLIENT,
+		53, 40000));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_UDP, TEST_CLIENT, TEST_SERVER,
+		40000, 80));
+	// Другие протоколы портами не ограничиваются
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_ICMP, TEST_CLIENT, TEST_SERVER, 0, 0));
+}
+
+// Проверка, что фрагменты без заголовка транспортного уровня пропускаются
+void test_RunFilter_NonFirstFragmentPassed()
+{
+	fc.filter_ports = TRUE;
+	add_in_plist(tcp_ports, htons(80));
+	fp = compile_filter(&fc, tcp_ports, udp_ports);
+	uint32_t len = make_package(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER,
+		40000, 443);
+	TEST_ASSERT_EQUAL_UINT32(0, run_filter(fp, package, len));
+	// Первый фрагмент (только флаг MF) проверяется по портам
+	package[6] = 0x20;
+	TEST_ASSERT_EQUAL_UINT32(0, run_filter(fp, package, len));
+	// Следующие фрагменты (ненулевое смещение) пропускаются
+	package[7] = 0x01;
+	TEST_ASSERT_NOT_EQUAL(0, run_filter(fp, package, len));
+	package[6] = 0x00;
+	TEST_ASSERT_NOT_EQUAL(0, run_filter(fp, package, len));
+}
+
+// Проверка переходов к меткам дальше 255 инструкций
+void test_CompileFilter_LongJumps()
+{
+	fc.filter_ports = TRUE;
+	for (uint32_t i = 0; i < FILTER_MAX_VALUES; i++)
+	{
+		add_in_filter_list(&fc.exclude_hosts, TEST_OTHER + 1 + i);
+		add_in_plist(tcp_ports, htons(1000 + i));
+	}
+	add_in_plist(udp_ports, htons(53));
+	fp = compile_filter(&fc, tcp_ports, udp_ports);
+	TEST_ASSERT_TRUE(fp->len > 2 * 255);
+	// Последний исключенный узел ведет к отбрасыванию в конце программы
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_TCP, TEST_CLIENT,
+		TEST_OTHER + FILTER_MAX_VALUES, 40000, 1000));
+	// Первый и последний разрешенные порты ведут к пропуску
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER,
+		40000, 1000));
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_TCP, TEST_SERVER, TEST_CLIENT,
+		1000 + FILTER_MAX_VALUES - 1, 40000));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_TCP, TEST_CLIENT, TEST_SERVER,
+		40000, 1000 + FILTER_MAX_VALUES));
+	// Переход к проверке UDP проходит мимо всей проверки TCP
+	TEST_ASSERT_TRUE(is_passed(IPPROTO_UDP, TEST_CLIENT, TEST_SERVER,
+		40000, 53));
+	TEST_ASSERT_FALSE(is_passed(IPPROTO_UDP, TEST_CLIENT, TEST_SERVER,
+		40000, 1000));
+}
+
+void setUp()
+{
+	ZeroMemory(&fc, sizeof(fc));
+	tcp_ports = create_plist();
+	udp_ports = create_plist();
+}
+
+void tearDown()
+{
+	if (fp != NULL)
+	{
+		free(fp->insns);
+		free(fp);
+		fp = NULL;
+	}
+	free_plist(tcp_ports);
+	free_plist(udp_ports);
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_CompileFilter_EmptyConfig);
+	RUN_TEST(test_RunFilter_ExcludeHosts);
+	RUN_TEST(test_RunFilter_IncludeHosts);
+	RUN_TEST(test_RunFilter_Protocols);
+	RUN_TEST(test_RunFilter_PortsBothDirections);
+	RUN_TEST(test_RunFilter_NonFirstFragmentPassed);
+	RUN_TEST(test_CompileFilter_LongJumps);
+	return UNITY_END();
+}
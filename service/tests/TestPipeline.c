@@ -0,0 +1,144 @@
+/******************************************************************************
+     * File: TestPipeline.c
+     * Description: Тестирование ограниченной очереди между этапами проверки
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "src\\unity.h"
+#include "..\\pipeline.h"
+
+#define TEST_QUEUE_SIZE 4 // Количество ячеек очереди тестов
+
+StageQueue queue; // Очередь тестов
+
+/**
+@brief Получает элемент очереди по номеру
+@param i Номер элемента
+@return Элемент
+*/
+void *get_test_item(uint32_t i)
+{
+	return (void *)(uintptr_t)(i + 1);
+}
+
+// Проверка округления количества ячеек до степени двойки
+void test_InitStageQueue_RoundSize()
+{
+	StageQueue q;
+	init_stage_queue(&q, 5);
+	TEST_ASSERT_EQUAL_UINT32(7, q.mask);
+	free(q.cells);
+	CloseHandle(q.event);
+	init_stage_queue(&q, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, q.mask);
+	free(q.cells);
+	CloseHandle(q.event);
+	TEST_ASSERT_EQUAL_UINT32(TEST_QUEUE_SIZE - 1, queue.mask);
+}
+
+// Проверка, что из пустой очереди ничего не забирается
+void test_PopStage_EmptyReturnsZero()
+{
+	void *items[TEST_QUEUE_SIZE];
+	TEST_ASSERT_EQUAL_UINT32(0, pop_stage(&queue, items, TEST_QUEUE_SIZE));
+	TEST_ASSERT_TRUE(try_push_stage(&queue, get_test_item(0)));
+	TEST_ASSERT_EQUAL_UINT32(1, pop_stage(&queue, items, TEST_QUEUE_SIZE));
+	TEST_ASSERT_EQUAL_UINT32(0, pop_stage(&queue, items, TEST_QUEUE_SIZE));
+}
+
+// Проверка, что в заполненную очередь элемент не добавляется
+void test_TryPushStage_FullReturnsFalse()
+{
+	void *items[TEST_QUEUE_SIZE];
+	for (uint32_t i = 0; i < TEST_QUEUE_SIZE; i++)
+		TEST_ASSERT_TRUE(try_push_stage(&queue, get_test_item(i)));
+	TEST_ASSERT_FALSE(try_push_stage(&queue, get_test_item(TEST_QUEUE_SIZE)));
+	// Освобожденная ячейка снова доступна для записи
+	TEST_ASSERT_EQUAL_UINT32(1, pop_stage(&queue, items, 1));
+	TEST_ASSERT_TRUE(try_push_stage(&queue, get_test_item(TEST_QUEUE_SIZE)));
+	TEST_ASSERT_FALSE(try_push_stage(&queue, get_test_item(0)));
+}
+
+// Проверка, что элементы забираются в порядке добавления
+void test_PopStage_KeepsOrder()
+{
+	void *items[TEST_QUEUE_SIZE];
+	for (uint32_t i = 0; i < 3; i++)
+		try_push_stage(&queue, get_test_item(i));
+	// Забирается не больше запрошенного
+	TEST_ASSERT_EQUAL_UINT32(2, pop_stage(&queue, items, 2));
+	TEST_ASSERT_EQUAL_PTR(get_test_item(0), items[0]);
+	TEST_ASSERT_EQUAL_PTR(get_test_item(1), items[1]);
+	try_push_stage(&queue, get_test_item(3));
+	TEST_ASSERT_EQUAL_UINT32(2, pop_stage(&queue, items, TEST_QUEUE_SIZE));
+	TEST_ASSERT_EQUAL_PTR(get_test_item(2), items[0]);
+	TEST_ASSERT_EQUAL_PTR(get_test_item(3), items[1]);
+}
+
+// Проверка порядка элементов при многократном обороте по ячейкам
+void test_PopStage_WrapAround()
+{
+	void *items[TEST_QUEUE_SIZE];
+	uint32_t pushed = 0;
+	uint32_t popped = 0;
+	// Пачки по 3 элемента не совпадают с границей ячеек
+	for (int cycle = 0; cycle < 10; cycle++)
+	{
+		for (int i = 0; i < 3; i++)
+			TEST_ASSERT_TRUE(try_push_stage(&queue, get_test_item(pushed++)));
+		uint32_t count = pop_stage(&queue, items, TEST_QUEUE_SIZE);
+		TEST_ASSERT_EQUAL_UINT32(3, count);
+		for (uint32_t i = 0; i < count; i++)
+			TEST_ASSERT_EQUAL_PTR(get_test_item(popped++), items[i]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(30, (uint32_t)queue.head);
+	TEST_ASSERT_EQUAL_UINT32(30, (uint32_t)queue.tail);
+}
+
+// Проверка работы очереди при переполнении счетчиков позиций
+void test_PopStage_PositionOverflow()
+{
+	void *items[TEST_QUEUE_SIZE];
+	// Пустая очередь за 2 позиции до переполнения LONG
+	LONG start = 0x7FFFFFFE;
+	queue.head = start;
+	queue.tail = start;
+	for (uint32_t i = 0; i < TEST_QUEUE_SIZE; i++)
+	{
+		LONG pos = (LONG)((ULONG)start + i);
+		queue.cells[pos & queue.mask].seq = pos;
+	}
+	for (uint32_t i = 0; i < TEST_QUEUE_SIZE; i++)
+		TEST_ASSERT_TRUE(try_push_stage(&queue, get_test_item(i)));
+	TEST_ASSERT_FALSE(try_push_stage(&queue, get_test_item(TEST_QUEUE_SIZE)));
+	TEST_ASSERT_EQUAL_UINT32(TEST_QUEUE_SIZE,
+		pop_stage(&queue, items, TEST_QUEUE_SIZE));
+	for (uint32_t i = 0; i < TEST_QUEUE_SIZE; i++)
+		TEST_ASSERT_EQUAL_PTR(get_test_item(i), items[i]);
+	TEST_ASSERT_EQUAL_UINT32(0, pop_stage(&queue, items, TEST_QUEUE_SIZE));
+}
+
+void setUp()
+{
+	init_stage_queue(&queue, TEST_QUEUE_SIZE);
+}
+
+void tearDown()
+{
+	free(queue.cells);
+	CloseHandle(queue.event);
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_InitStageQueue_RoundSize);
+	RUN_TEST(test_PopStage_EmptyReturnsZero);
+	RUN_TEST(test_TryPushStage_FullReturnsFalse);
+	RUN_TEST(test_PopStage_KeepsOrder);
+	RUN_TEST(test_PopStage_WrapAround);
+	RUN_TEST(test_PopStage_PositionOverflow);
+	return UNITY_END();
+}
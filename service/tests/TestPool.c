@@ -0,0 +1,205 @@
+/******************************************************************************
+     * File: TestPool.c
+     * Description: Тестирование пулов слотов и магазинов кэша потока
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "src\\unity.h"
+#include "..\\pool.h"
+
+#define TEST_SLOT_SIZE  2000 // Размер слота (округляется до 2048)
+#define TEST_SLOT_COUNT  256 // Начальное количество слотов (магазин - 4)
+#define TEST_JUMBO_COUNT   2 // Количество слотов больших пакетов
+
+extern SlotPool pools[POOL_COUNT];
+extern DWORD cache_tls;
+
+int get_slot_pool(const char *slot);
+
+/**
+@brief Получает количество магазинов на складе пула
+@param pool Номер пула
+@return Количество магазинов
+*/
+uint32_t get_depot_size(int pool)
+{
+	return (uint32_t)(pools[pool].full.tail - pools[pool].full.head);
+}
+
+/**
+@brief Пересоздает пулы с заданными размерами
+@param slot_count Начальное количество слотов обычного размера
+@param slot_limit Наибольшее количество слотов обычного размера
+*/
+void reset_pools(uint32_t slot_count, uint32_t slot_limit);
+
+// Проверка, что освобожденный слот берется повторно из магазина потока
+void test_AllocSlot_ReuseFreed()
+{
+	char *slot = alloc_slot(100);
+	TEST_ASSERT_NOT_NULL(slot);
+	TEST_ASSERT_EQUAL_UINT32(2048, get_slot_size(slot));
+	slot[2047] = 1;
+	free_slot(slot);
+	TEST_ASSERT_EQUAL_PTR(slot, alloc_slot(TEST_SLOT_SIZE));
+	free_slot(slot);
+}
+
+// Проверка, что поток обращается к складу только при пустых магазинах
+void test_AllocSlot_MagazineFromDepot()
+{
+	uint32_t mag_size = pools[POOL_MTU].mag_size;
+	uint32_t depot = get_depot_size(POOL_MTU);
+	char *slots[8];
+	TEST_ASSERT_EQUAL_UINT32(4, mag_size);
+	TEST_ASSERT_EQUAL_UINT32(TEST_SLOT_COUNT / mag_size, depot);
+	// Первый магазин берется со склада целиком
+	slots[0] = alloc_slot(100);
+	TEST_ASSERT_EQUAL_UINT32(depot - 1, get_depot_size(POOL_MTU));
+	for (uint32_t i = 1; i < mag_size; i++)
+		slots[i] = alloc_slot(100);
+	TEST_ASSERT_EQUAL_UINT32(depot - 1, get_depot_size(POOL_MTU));
+	slots[mag_size] = alloc_slot(100);
+	TEST_ASSERT_EQUAL_UINT32(depot - 2, get_depot_size(POOL_MTU));
+	// Возвращенные слоты заполняют оба магазина потока, склад не меняется
+	for (uint32_t i = 0; i <= mag_size; i++)
+		free_slot(slots[i]);
+	TEST_ASSERT_EQUAL_UINT32(depot - 2, get_depot_size(POOL_MTU));
+	// При завершении потока магазины возвращаются на склад
+	flush_slot_cache();
+	TEST_ASSERT_NULL(TlsGetValue(cache_tls));
+	TEST_ASSERT_EQUAL_UINT32(depot, get_depot_size(POOL_MTU));
+}
+
+// Проверка, что полный магазин потока уходит на склад
+void test_FreeSlot_FullMagazineToDepot()
+{
+	uint32_t mag_size = pools[POOL_MTU].mag_size;
+	uint32_t depot = get_depot_size(POOL_MTU);
+	char *slots[12];
+	for (uint32_t i = 0; i < 3 * mag_size; i++)
+		slots[i] = alloc_slot(100);
+	TEST_ASSERT_EQUAL_UINT32(depot - 3, get_depot_size(POOL_MTU));
+	// Два магазина остаются у потока, третий возвращается на склад
+	for (uint32_t i = 0; i < 3 * mag_size; i++)
+		free_slot(slots[i]);
+	TEST_ASSERT_EQUAL_UINT32(depot - 2, get_depot_size(POOL_MTU));
+}
+
+// Проверка выбора пула по размеру пакета и определения пула слота
+void test_GetSlotPool_Classify()
+{
+	char *mtu = alloc_slot(2048);
+	char *jumbo = alloc_slot(2049);
+	TEST_ASSERT_EQUAL_INT(POOL_MTU, get_slot_pool(mtu));
+	TEST_ASSERT_EQUAL_INT(POOL_JUMBO, get_slot_pool(jumbo));
+	TEST_ASSERT_EQUAL_UINT32(JUMBO_SLOT_SIZE, get_slot_size(jumbo));
+	// Границы области слотов обычного размера
+	char *end = pools[POOL_MTU].memory +
+		(size_t)pools[POOL_MTU].slot_limit * pools[POOL_MTU].slot_size;
+	TEST_ASSERT_EQUAL_INT(POOL_MTU, get_slot_pool(pools[POOL_MTU].memory));
+	TEST_ASSERT_EQUAL_INT(POOL_MTU, get_slot_pool(end - 2048));
+	TEST_ASSERT_EQUAL_INT(POOL_JUMBO, get_slot_pool(end));
+	// Пакет больше слота большого пакета не принимается
+	TEST_ASSERT_NULL(alloc_slot(JUMBO_SLOT_SIZE + 1));
+	free_slot(mtu);
+	free_slot(jumbo);
+}
+
+// Проверка, что без слотов обычного размера берется слот большого пакета
+void test_AllocSlot_FallbackToJumbo()
+{
+	reset_pools(4, 4);
+	char *slots[4];
+	for (int i = 0; i < 4; i++)
+	{
+		slots[i] = alloc_slot(100);
+		TEST_ASSERT_EQUAL_INT(POOL_MTU, get_slot_pool(slots[i]));
+	}
+	char *jumbo[TEST_JUMBO_COUNT];
+	for (int i = 0; i < TEST_JUMBO_COUNT; i++)
+	{
+		jumbo[i] = alloc_slot(100);
+		TEST_ASSERT_NOT_NULL(jumbo[i]);
+		TEST_ASSERT_EQUAL_INT(POOL_JUMBO, get_slot_pool(jumbo[i]));
+	}
+	TEST_ASSERT_NULL(alloc_slot(100));
+	// Освобожденный слот обычного размера снова берется первым
+	free_slot(slots[0]);
+	TEST_ASSERT_EQUAL_PTR(slots[0], alloc_slot(100));
+}
+
+// Проверка добавления слотов частями до наибольшего количества
+void test_AllocSlot_GrowPool()
+{
+	reset_pools(4, 10);
+	char *slots[10];
+	for (int i = 0; i < 10; i++)
+	{
+		slots[i] = alloc_slot(100);
+		TEST_ASSERT_EQUAL_INT(POOL_MTU, get_slot_pool(slots[i]));
+		// Слот доступен для записи
+		memset(slots[i], i, 2048);
+	}
+	// Пул вырос на 4 и на оставшиеся 2 слота
+	TEST_ASSERT_EQUAL_UINT32(10, pools[POOL_MTU].slot_count);
+	for (int i = 0; i < 10; i++)
+		for (int j = i + 1; j < 10; j++)
+			TEST_ASSERT_TRUE(slots[i] != slots[j]);
+	TEST_ASSERT_EQUAL_INT(POOL_JUMBO, get_slot_pool(alloc_slot(100)));
+	TEST_ASSERT_EQUAL_UINT32(10, pools[POOL_MTU].slot_count);
+}
+
+/**
+@brief Освобождает пулы и кэш потока
+*/
+void free_pools()
+{
+	flush_slot_cache();
+	for (int i = 0; i < POOL_COUNT; i++)
+	{
+		SlotMagazine *mag;
+		while (pop_stage(&pools[i].full, (void **)&mag, 1) > 0)
+			free(mag);
+		while (pop_stage(&pools[i].empty, (void **)&mag, 1) > 0)
+			free(mag);
+		free(pools[i].full.cells);
+		free(pools[i].empty.cells);
+		CloseHandle(pools[i].full.event);
+		CloseHandle(pools[i].empty.event);
+		DeleteCriticalSection(&pools[i].grow_lock);
+		VirtualFree(pools[i].memory, 0, MEM_RELEASE);
+	}
+	TlsFree(cache_tls);
+}
+
+void reset_pools(uint32_t slot_count, uint32_t slot_limit)
+{
+	free_pools();
+	init_slot_pools(TEST_SLOT_SIZE, slot_count, slot_limit, TEST_JUMBO_COUNT);
+}
+
+void setUp()
+{
+	init_slot_pools(TEST_SLOT_SIZE, TEST_SLOT_COUNT, TEST_SLOT_COUNT,
+		TEST_JUMBO_COUNT);
+}
+
+void tearDown()
+{
+	free_pools();
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_AllocSlot_ReuseFreed);
+	RUN_TEST(test_AllocSlot_MagazineFromDepot);
+	RUN_TEST(test_FreeSlot_FullMagazineToDepot);
+	RUN_TEST(test_GetSlotPool_Classify);
+	RUN_TEST(test_AllocSlot_FallbackToJumbo);
+	RUN_TEST(test_AllocSlot_GrowPool);
+	return UNITY_END();
+}
@@ -0,0 +1,167 @@
+/******************************************************************************
+     * File: TestReasm.c
+     * Description: Тестирование сборки фрагментированных IPv4-пакетов
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "src\\unity.h"
+#include "..\\reasm.h"
+
+#define TEST_HEADER_LEN 20 // Длина IP-заголовка фрагментов
+#define TEST_ID     0x1234 // Идентификатор датаграммы
+
+extern ReasmBuffer *reasm_buffers;
+extern uint32_t reasm_count;
+extern HANDLE reasm_mutex;
+
+char fragment[TEST_HEADER_LEN + 1024]; // Пакет тестов
+
+/**
+@brief Формирует фрагмент датаграммы, данные которого - номер байта
+в датаграмме
+@param beg Смещение данных фрагмента в байтах (кратно 8)
+@param len Длина данных фрагмента
+@param more Есть ли ещё фрагменты
+@return Длина пакета
+*/
+size_t make_fragment(uint16_t beg, uint16_t len, Bool more)
+{
+	uint8_t *p = (uint8_t *)fragment;
+	size_t size = TEST_HEADER_LEN + len;
+	uint16_t offset = (beg >> 3) | (more ? 0x2000 : 0);
+	memset(p, 0, TEST_HEADER_LEN);
+	p[0] = 0x45;
+	p[2] = size >> 8;
+	p[3] = size & 0xFF;
+	p[4] = TEST_ID >> 8;
+	p[5] = TEST_ID & 0xFF;
+	p[6] = offset >> 8;
+	p[7] = offset & 0xFF;
+	p[9] = 17;
+	p[12] = 10;
+	p[15] = 1;
+	p[16] = 10;
+	p[19] = 2;
+	for (uint16_t i = 0; i < len; i++)
+		p[TEST_HEADER_LEN + i] = (uint8_t)(beg + i);
+	return size;
+}
+
+/**
+@brief Передает фрагмент на сборку
+@param beg Смещение данных фрагмента в байтах (кратно 8)
+@param len Длина данных фрагмента
+@param more Есть ли ещё фрагменты
+@param rb Для записи буфера собранной датаграммы
+@return Результат reassemble_package
+*/
+uint8_t send_fragment(uint16_t beg, uint16_t len, Bool more, ReasmBuffer **rb)
+{
+	size_t size = make_fragment(beg, len, more);
+	return reassemble_package(fragment, size, rb);
+}
+
+/**
+@brief Проверяет собранную датаграмму и освобождает буфер
+@param rb Буфер собранной датаграммы
+@param total Ожидаемая длина данных
+*/
+void check_datagram(ReasmBuffer *rb, uint16_t total)
+{
+	const uint8_t *p = (const uint8_t *)rb->package;
+	TEST_ASSERT_EQUAL_UINT32(TEST_HEADER_LEN + total, rb->size);
+	TEST_ASSERT_EQUAL_UINT16(TEST_HEADER_LEN + total, p[2] << 8 | p[3]);
+	// Флаги и смещение собранной датаграммы сброшены
+	TEST_ASSERT_EQUAL_UINT8(0, p[6]);
+	TEST_ASSERT_EQUAL_UINT8(0, p[7]);
+	for (uint16_t i = 0; i < total; i++)
+		TEST_ASSERT_EQUAL_UINT8((uint8_t)i, p[TEST_HEADER_LEN + i]);
+	release_reasm_buffer(rb);
+}
+
+// Проверка, что нефрагментированный пакет не собирается
+void test_ReassemblePackage_PassWhole()
+{
+	ReasmBuffer *rb = NULL;
+	size_t size = make_fragment(0, 16, FALSE);
+	TEST_ASSERT_EQUAL_UINT8(REASM_PASS,
+		reassemble_package(fragment, size, &rb));
+	TEST_ASSERT_NULL(rb);
+}
+
+// Проверка сборки фрагментов, пришедших по порядку
+void test_ReassemblePackage_InOrder()
+{
+	ReasmBuffer *rb = NULL;
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(0, 16, TRUE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(16, 16, TRUE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_DONE, send_fragment(32, 5, FALSE, &rb));
+	check_datagram(rb, 37);
+}
+
+// Проверка сборки фрагментов в обратном порядке с перекрытием
+void test_ReassemblePackage_OutOfOrderOverlap()
+{
+	ReasmBuffer *rb = NULL;
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(24, 3, FALSE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(8, 16, TRUE, &rb));
+	// Перекрывающийся блок учитывается один раз
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(8, 8, TRUE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_DONE, send_fragment(0, 8, TRUE, &rb));
+	check_datagram(rb, 27);
+}
+
+// Проверка, что блок за концом датаграммы не закрывает пропуск в ней
+void test_ReassemblePackage_HoleNotFilledPastEnd()
+{
+	ReasmBuffer *rb = NULL;
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(0, 8, TRUE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(1000, 8, TRUE, &rb));
+	// Блоков 3, как и в датаграмме длиной 24, но блок [8, 16) пропущен
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(16, 8, FALSE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_DONE, send_fragment(8, 8, TRUE, &rb));
+	check_datagram(rb, 24);
+}
+
+// Проверка, что фрагмент за известным концом датаграммы отбрасывается
+void test_ReassemblePackage_DropPastKnownEnd()
+{
+	ReasmBuffer *rb = NULL;
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(16, 8, FALSE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(1000, 8, TRUE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(0, 8, TRUE, &rb));
+	// Последний фрагмент с другой длиной датаграммы не принимается
+	TEST_ASSERT_EQUAL_UINT8(REASM_HOLD, send_fragment(8, 8, FALSE, &rb));
+	TEST_ASSERT_EQUAL_UINT8(REASM_DONE, send_fragment(8, 8, TRUE, &rb));
+	check_datagram(rb, 24);
+}
+
+void setUp()
+{
+	// Памяти хватает на два буфера сборки
+	init_reasm(2 * (sizeof(ReasmBuffer) + REASM_MAX_HEADER +
+		REASM_MAX_DATA), 1000, 2);
+}
+
+void tearDown()
+{
+	for (uint32_t i = 0; i < reasm_count; i++)
+		free(reasm_buffers[i].data);
+	free(reasm_buffers);
+	CloseHandle(reasm_mutex);
+	reasm_buffers = NULL;
+	reasm_count = 0;
+}
+
+int main()
+{
+	UNITY_BEGIN();
+	RUN_TEST(test_ReassemblePackage_PassWhole);
+	RUN_TEST(test_ReassemblePackage_InOrder);
+	RUN_TEST(test_ReassemblePackage_OutOfOrderOverlap);
+	RUN_TEST(test_ReassemblePackage_HoleNotFilledPastEnd);
+	RUN_TEST(test_ReassemblePackage_DropPastKnownEnd);
+	return UNITY_END();
+}
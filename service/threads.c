@@ -0,0 +1,237 @@
+/******************************************************************************
+     * File: threads.c
+     * Description: Закрепление потоков за процессорами по топологии.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "threads.h"
+#include "filemanager.h"
+
+const char *tclass_names[TCLASS_COUNT] = { "sniffer", "analyzer", "helper" };
+DWORD_PTR class_masks[TCLASS_COUNT];         // Процессоры классов (0 - любые)
+uint8_t class_cpus[TCLASS_COUNT][MAX_CPU_COUNT]; // Процессоры по порядку
+uint32_t class_cpu_count[TCLASS_COUNT];      // Количество процессоров класса
+DWORD_PTR cache_masks[MAX_CPU_COUNT]; // Процессоры с общим последним кэшем
+DWORD_PTR node_masks[MAX_CPU_COUNT];  // Процессоры одного узла NUMA
+DWORD_PTR present_mask = 0;           // Все логические процессоры
+uint32_t thread_groups = 1;           // Адаптеров, делящих анализаторы
+Bool adapter_siblings = TRUE;         // Держать анализаторы рядом с приёмом
+
+/**
+@brief Заполняет маски ядер, кэшей и узлов NUMA по данным системы
+@param cores Для записи количества ядер
+@param caches Для записи количества последних кэшей
+@param nodes Для записи количества узлов NUMA
+*/
+void read_topology(uint32_t *cores, uint32_t *caches, uint32_t *nodes);
+
+/**
+@brief Получает процессоры набора, ближайшие к процессору: с общим
+последним кэшем, затем того же узла NUMA
+@param cpu Процессор
+@param set Набор процессоров
+@return Маска процессоров (весь набор, если рядом нет ни одного)
+*/
+DWORD_PTR get_sibling_mask(uint8_t cpu, DWORD_PTR set);
+
+/**
+@brief Записывает номера процессоров маски через запятую
+@param mask Маска процессоров
+@param buff Для записи строки
+@param size Размер буфера
+*/
+void format_cpu_mask(DWORD_PTR mask, char *buff, size_t size);
+
+void init_threads()
+{
+	// Получение параметров
+	while (is_reading_settings_section("Threads"))
+	{
+		const char *name = read_setting_name();
+		uint8_t tclass = TCLASS_COUNT;
+		if (strcmp(name, "sniffer_cpus") == 0)
+			tclass = TCLASS_SNIFFER;
+		else if (strcmp(name, "analyzer_cpus") == 0)
+			tclass = TCLASS_ANALYZER;
+		else if (strcmp(name, "helper_cpus") == 0)
+			tclass = TCLASS_HELPER;
+		else if (strcmp(name, "adapter_siblings") == 0)
+			adapter_siblings = read_setting_u() != 0;
+		else
+			print_not_used(name);
+		if (tclass != TCLASS_COUNT)
+			while (is_reading_setting_value())
+			{
+				uint32_t cpu = read_setting_u();
+				// Сдвиг на номер вне маски не определен, поэтому он не делается
+				if (cpu >= MAX_CPU_COUNT)
+					continue;
+				DWORD_PTR bit = (DWORD_PTR)1 << cpu;
+				if ((class_masks[tclass] & bit) == 0)
+				{
+					class_masks[tclass] |= bit;
+					class_cpus[tclass][class_cpu_count[tclass]++] = cpu;
+				}
+			}
+	}
+
+	uint32_t cores, caches, nodes;
+	read_topology(&cores, &caches, &nodes);
+	uint32_t cpus = 0;
+	for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; cpu++)
+		if (present_mask & (DWORD_PTR)1 << cpu)
+			cpus++;
+	print_msglogf("CPU topology: %u logical processors, %u cores, "
+		"%u last-level caches, %u NUMA nodes.\n", cpus, cores, caches, nodes);
+	// Процессоры, которых нет в системе, не используются
+	for (int c = 0; c < TCLASS_COUNT; c++)
+	{
+		char buff[4 * MAX_CPU_COUNT];
+		uint32_t n = 0;
+		for (uint32_t i = 0; i < class_cpu_count[c]; i++)
+			if (present_mask & (DWORD_PTR)1 << class_cpus[c][i])
+				class_cpus[c][n++] = class_cpus[c][i];
+			else
+			{
+				// Файловый менеджер еще не запущен
+				snprintf(buff, sizeof(buff), "CPU %u of %s threads is not "
+					"present", class_cpus[c][i], tclass_names[c]);
+				print_errlog(buff);
+			}
+		class_cpu_count[c] = n;
+		class_masks[c] &= present_mask;
+		format_cpu_mask(class_masks[c], buff, sizeof(buff));
+		print_msglogf("CPUs of %s threads: %s.\n", tclass_names[c],
+			class_masks[c] != 0 ? buff : "any");
+	}
+}
+
+void set_thread_groups(uint32_t count)
+{
+	thread_groups = count > 0 ? count : 1;
+}
+
+void place_thread(HANDLE thread, uint8_t tclass, uint32_t index,
+	const char *name)
+{
+	if (thread == NULL || class_masks[tclass] == 0)
+		return;
+	DWORD_PTR mask = class_masks[tclass];
+	// Поток приёма занимает один процессор
+	if (tclass == TCLASS_SNIFFER)
+		mask = (DWORD_PTR)1 << class_cpus[tclass][index %
+			class_cpu_count[tclass]];
+	// Анализатор работает рядом с приёмом своего адаптера, чтобы пакеты
+	// оставались в общем кэше
+	else if (tclass == TCLASS_ANALYZER && adapter_siblings &&
+		class_cpu_count[TCLASS_SNIFFER] > 0)
+	{
+		uint32_t group = index % thread_groups;
+		mask = get_sibling_mask(class_cpus[TCLASS_SNIFFER][group %
+			class_cpu_count[TCLASS_SNIFFER]], mask);
+	}
+	char buff[4 * MAX_CPU_COUNT];
+	format_cpu_mask(mask, buff, sizeof(buff));
+	if (SetThreadAffinityMask(thread, mask) == 0)
+		print_errlogf("Failed to place %s on CPUs %s", name, buff);
+	else
+		print_msglogf("%s placed on CPUs %s.\n", name, buff);
+}
+
+uint32_t get_thread_group(uint32_t index)
+{
+	// Группы имеют смысл, только если анализаторы размещены рядом с приёмом
+	// и адаптеров несколько
+	if (class_masks[TCLASS_ANALYZER] == 0 || !adapter_siblings ||
+		class_cpu_count[TCLASS_SNIFFER] == 0 || thread_groups < 2)
+		return THREAD_GROUP_ANY;
+	return index % thread_groups;
+}
+
+void read_topology(uint32_t *cores, uint32_t *caches, uint32_t *nodes)
+{
+	*cores = 0;
+	*caches = 0;
+	*nodes = 0;
+	DWORD len = 0;
+	GetLogicalProcessorInformation(NULL, &len);
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info =
+		(SYSTEM_LOGICAL_PROCESSOR_INFORMATION *)malloc(len);
+	if (info == NULL || !GetLogicalProcessorInformation(info, &len))
+	{
+		free(info);
+		print_errlog("Failed to get processor topology");
+		// Без топологии каждый процессор считается отдельным ядром
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		for (uint32_t cpu = 0; cpu < si.dwNumberOfProcessors &&
+			cpu < MAX_CPU_COUNT; cpu++)
+			present_mask |= (DWORD_PTR)1 << cpu;
+		return;
+	}
+	uint8_t cache_levels[MAX_CPU_COUNT];
+	ZeroMemory(cache_levels, sizeof(cache_levels));
+	uint32_t count = len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		DWORD_PTR mask = info[i].ProcessorMask;
+		if (info[i].Relationship == RelationProcessorCore)
+		{
+			(*cores)++;
+			present_mask |= mask;
+			continue;
+		}
+		else if (info[i].Relationship == RelationNumaNode)
+			(*nodes)++;
+		else if (info[i].Relationship != RelationCache ||
+			info[i].Cache.Type == CacheInstruction)
+			continue;
+		for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; cpu++)
+		{
+			if ((mask & (DWORD_PTR)1 << cpu) == 0)
+				continue;
+			if (info[i].Relationship == RelationNumaNode)
+				node_masks[cpu] = mask;
+			// Последний кэш - кэш самого высокого уровня
+			else if (info[i].Cache.Level >= cache_levels[cpu])
+			{
+				cache_levels[cpu] = info[i].Cache.Level;
+				cache_masks[cpu] = mask;
+			}
+		}
+	}
+	free(info);
+	// Последние кэши считаются по различным маскам
+	DWORD_PTR counted = 0;
+	for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT; cpu++)
+		if (cache_masks[cpu] != 0 && (counted & (DWORD_PTR)1 << cpu) == 0)
+		{
+			counted |= cache_masks[cpu];
+			(*caches)++;
+		}
+}
+
+DWORD_PTR get_sibling_mask(uint8_t cpu, DWORD_PTR set)
+{
+	// Анализаторы одного адаптера делят все процессоры общего кэша, а не
+	// только второй логический процессор ядра приёма; ядро входит в общий
+	// кэш, поэтому отдельно не проверяется
+	DWORD_PTR self = (DWORD_PTR)1 << cpu;
+	DWORD_PTR domains[2] = { cache_masks[cpu], node_masks[cpu] };
+	for (int i = 0; i < 2; i++)
+		if ((domains[i] & set & ~self) != 0)
+			return domains[i] & set & ~self;
+	return set;
+}
+
+void format_cpu_mask(DWORD_PTR mask, char *buff, size_t size)
+{
+	size_t len = 0;
+	buff[0] = '\0';
+	for (uint32_t cpu = 0; cpu < MAX_CPU_COUNT && len < size; cpu++)
+		if (mask & (DWORD_PTR)1 << cpu)
+			len += snprintf(buff + len, size - len, len > 0 ? ",%u" : "%u",
+				cpu);
+}
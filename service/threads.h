@@ -0,0 +1,54 @@
+/******************************************************************************
+     * File: threads.h
+     * Description: Закрепление потоков за процессорами по топологии.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+#include "settings.h"
+
+#define MAX_CPU_COUNT (sizeof(DWORD_PTR) * 8) // Процессоров в маске
+// Классы потоков
+#define TCLASS_SNIFFER  0 // Приём пакетов (адаптеры, общие потоки, повтор)
+#define TCLASS_ANALYZER 1 // Проверка пакетов
+#define TCLASS_HELPER   2 // Статистика, детекторы, сохранение в файлы
+#define TCLASS_COUNT    3
+#define THREAD_GROUP_ANY 0xFFFFFFFF // Поток не привязан к адаптеру
+
+/**
+@brief Считывает раздел Threads и топологию процессоров и выводит её
+*/
+void init_threads();
+
+/**
+@brief Задает количество адаптеров, между которыми делятся анализаторы
+@param count Количество адаптеров
+*/
+void set_thread_groups(uint32_t count);
+
+/**
+@brief Закрепляет поток за процессорами его класса и выводит размещение
+@note Поток приёма занимает один процессор своего набора по номеру адаптера,
+анализатор - процессоры своего набора рядом с приёмом адаптера
+get_thread_group
+@param thread Поток
+@param tclass Класс потока
+@param index Номер потока в классе
+@param name Название потока для вывода
+*/
+void place_thread(HANDLE thread, uint8_t tclass, uint32_t index,
+	const char *name);
+
+/**
+@brief Получает адаптер, рядом с приёмом которого размещается анализатор
+@param index Номер анализатора в классе
+@return Номер адаптера (THREAD_GROUP_ANY - анализатор размещается без
+учета адаптеров)
+*/
+uint32_t get_thread_group(uint32_t index);
+
+#endif
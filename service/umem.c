@@ -0,0 +1,40 @@
+/******************************************************************************
+     * File: umem.c
+     * Description: Общая память кадров для приёма пакетов без копирования.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#include "umem.h"
+
+UmemPool *create_umem(uint32_t frame_count, uint32_t frame_size)
+{
+	UmemPool *pool = (UmemPool *)malloc(sizeof(UmemPool));
+	pool->frame_size = frame_size;
+	pool->frame_count = frame_count;
+	pool->memory = (char *)malloc((size_t)frame_count * frame_size);
+	pool->frames = (UmemFrame *)malloc(frame_count * sizeof(UmemFrame));
+	init_stage_queue(&pool->fill, frame_count);
+	// Все кадры изначально свободны
+	for (uint32_t i = 0; i < frame_count; i++)
+	{
+		pool->frames[i].pool = pool;
+		pool->frames[i].index = i;
+		pool->frames[i].data = pool->memory + (size_t)i * frame_size;
+		push_stage(&pool->fill, &pool->frames[i]);
+	}
+	return pool;
+}
+
+Bool pop_fill_ring(UmemPool *pool, UmemFrame **frame)
+{
+	return pop_stage(&pool->fill, (void **)frame, 1) > 0;
+}
+
+void release_umem_frame(UmemFrame *frame)
+{
+	// Кадр находится либо в кольце, либо у анализатора,
+	// поэтому кольцо не переполняется
+	push_stage(&frame->pool->fill, frame);
+}
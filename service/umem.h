@@ -0,0 +1,55 @@
+/******************************************************************************
+     * File: umem.h
+     * Description: Общая память кадров для приёма пакетов без копирования.
+     * Created: 17 октября 2026
+     * Author: Секунов Александр
+
+******************************************************************************/
+
+#ifndef __UMEM_H__
+#define __UMEM_H__
+
+#include "settings.h"
+#include "pipeline.h"
+
+// Кадр общей памяти, в котором пакет принимается и анализируется
+typedef struct UmemFrame
+{
+	struct UmemPool *pool;  // Область, которой принадлежит кадр
+	uint32_t index;         // Номер кадра в области
+	char *data;             // Память кадра
+} UmemFrame;
+
+// Область кадров с кольцом свободных кадров (fill ring)
+typedef struct UmemPool
+{
+	char *memory;         // Память всех кадров
+	UmemFrame *frames;    // Описания кадров
+	uint32_t frame_size;  // Размер кадра в байтах
+	uint32_t frame_count; // Количество кадров
+	StageQueue fill;      // Кольцо кадров, готовых к приёму
+} UmemPool;
+
+/**
+@brief Создает область кадров, все кадры которой свободны
+@param frame_count Количество кадров
+@param frame_size Размер кадра в байтах
+@return Область кадров
+*/
+UmemPool *create_umem(uint32_t frame_count, uint32_t frame_size);
+
+/**
+@brief Извлекает свободный кадр из кольца
+@param pool Область кадров
+@param frame Для записи свободного кадра
+@return FALSE - свободных кадров нет
+*/
+Bool pop_fill_ring(UmemPool *pool, UmemFrame **frame);
+
+/**
+@brief Возвращает кадр в кольцо свободных после обработки пакета
+@param frame Обработанный кадр
+*/
+void release_umem_frame(UmemFrame *frame);
+
+#endif